@@ -44,8 +44,19 @@ public:
 		n_rows = nrow + ((nrow%8)?(8-(nrow%8)):0);
 		n_cols = ncol + ((ncol%8)?(8-(ncol%8)):0);
 		n_bytes = (n_cols/8) * (unsigned long)n_rows;
-		bytes = (unsigned char*)malloc(n_bytes*sizeof(unsigned char));
-		memset(bytes, 0, n_bytes);
+		bytes = (unsigned char*)calloc(n_bytes, sizeof(unsigned char));
+	}
+
+	/*
+	 * Changes the number of rows while keeping the first rows, so that the matrix can grow while being filled row by row.
+	 * Added rows are zeroed.
+	 */
+	void resizeRows(unsigned int nrow) {
+		unsigned long prev_rows = n_rows;
+		n_rows = nrow + ((nrow%8)?(8-(nrow%8)):0);
+		n_bytes = (n_cols/8) * (unsigned long)n_rows;
+		bytes = (unsigned char*)realloc(bytes, n_bytes);
+		if (n_rows > prev_rows) memset(bytes + prev_rows * (n_cols/8), 0, (n_rows - prev_rows) * (n_cols/8));
 	}
 
 	~bitmatrix() {
@@ -62,14 +73,16 @@ public:
 	 * Timur Kristóf: https://github.com/venemo
 	 * Original version of the code (MIT license): https://github.com/Venemo/fecmagic/blob/master/src/binarymatrix.h
 	 * Of note, function abracadabra is the same than getMultiplyUpperPart function in the original code from Timur Kristóf.
+	 * Only columns [_min_col, _max_col) are transposed into rows of BM, _min_col being rounded down to a multiple of 8.
 	 */
-	void transpose(bitmatrix & BM, unsigned int _max_row, unsigned int _max_col) {
+	void transpose(bitmatrix & BM, unsigned int _max_row, unsigned int _min_col, unsigned int _max_col) {
 		unsigned int max_row = _max_row + ((_max_row%8)?(8-(_max_row%8)):0);
+		unsigned int min_col = _min_col - (_min_col%8);
 		unsigned int max_col = _max_col + ((_max_col%8)?(8-(_max_col%8)):0);
 		unsigned long targetAddr, sourceAddr;
 		union { unsigned int x[2]; unsigned char b[8]; } m4x8d;
 		for (unsigned int row = 0; row < max_row; row += 8) {
-			for (unsigned int col = 0; col < max_col; col += 8) {
+			for (unsigned int col = min_col; col < max_col; col += 8) {
 				for (unsigned int i = 0; i < 8; i++) {
 					sourceAddr = (row+i) * ((unsigned long)(n_cols/8)) + col/8;
 					m4x8d.b[7 - i] = this->bytes[sourceAddr];
@@ -85,6 +98,11 @@ public:
 			}
 		}
 	}
+
+	//Transposes the whole matrix into BM
+	void transpose(bitmatrix & BM, unsigned int _max_row, unsigned int _max_col) {
+		transpose(BM, _max_row, 0, _max_col);
+	}
 };
 
 inline
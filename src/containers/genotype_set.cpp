@@ -24,31 +24,168 @@
 genotype_set::genotype_set() {
 	n_site = 0;
 	n_ind = 0;
+	sparse = false;
+	arenaVariants = NULL;
+	vstride = 0;
+	i_workers = 0;
+	pthread_mutex_init(&mutex_workers, NULL);
 }
 
 genotype_set::~genotype_set() {
-	for (int i = 0 ; i< vecG.size() ; i ++) delete vecG[i];
+	pthread_mutex_destroy(&mutex_workers);
 	vecG.clear();
+	storeG.clear();
+	if (arenaVariants) free(arenaVariants);
+	arenaVariants = NULL;
 	n_site = 0;
 	n_ind = 0;
 }
 
+void genotype_set::allocate(unsigned int _n_ind, unsigned int _n_capacity) {
+	n_ind = _n_ind;
+	n_site = 0;
+	vstride = 0;
+	if (sparse) bufferSparse = vector < vector < unsigned int > > (n_ind);
+	storeG.clear();
+	storeG.reserve(n_ind);
+	vecG = vector < genotype * > (n_ind);
+	for (unsigned int i = 0 ; i < n_ind ; i ++) {
+		storeG.emplace_back(i);
+		vecG[i] = &storeG[i];
+	}
+	reserve(_n_capacity);
+}
+
+void genotype_set::reserve(unsigned int n_capacity) {
+	if (sparse) {
+		if (n_capacity > SPA_MAX_SITE) vrb.error("Too many variants for sparse genotype storage [" + stb.str(n_capacity) + "]");
+		return;
+	}
+	unsigned long n_vbytes = DIV2(n_capacity) + MOD2(n_capacity);
+	if (n_vbytes <= vstride) return;
+	arenaVariants = (unsigned char *)realloc(arenaVariants, n_ind * n_vbytes);
+	if (!arenaVariants) vrb.error("Impossible to allocate genotype storage for [" + stb.str(n_capacity) + "] variants");
+	//Spread individuals to the new stride, last first so that nothing is overwritten before being moved
+	for (long i = n_ind - 1 ; i >= 0 ; i --) {
+		memmove(arenaVariants + i * n_vbytes, arenaVariants + i * vstride, vstride);
+		memset(arenaVariants + i * n_vbytes + vstride, 0, n_vbytes - vstride);
+	}
+	vstride = n_vbytes;
+	for (unsigned int i = 0 ; i < n_ind ; i ++) vecG[i]->Variants = arenaVariants + i * vstride;
+}
+
+void genotype_set::finalise(unsigned int _n_site) {
+	n_site = _n_site;
+	for (unsigned int i = 0 ; i < n_ind ; i ++) vecG[i]->n_variants = n_site;
+	if (sparse) return;
+	unsigned long n_vbytes = DIV2(n_site) + MOD2(n_site);
+	//Pack individuals to the exact stride, first first
+	for (unsigned long i = 0 ; i < n_ind ; i ++) {
+		memmove(arenaVariants + i * n_vbytes, arenaVariants + i * vstride, n_vbytes);
+		if (MOD2(n_site)) arenaVariants[i * n_vbytes + n_vbytes - 1] &= 0x0F;
+	}
+	unsigned char * arenaShrunk = (unsigned char *)realloc(arenaVariants, max(n_ind * n_vbytes, 1UL));
+	if (arenaShrunk) arenaVariants = arenaShrunk;
+	vstride = n_vbytes;
+	for (unsigned int i = 0 ; i < n_ind ; i ++) vecG[i]->Variants = arenaVariants + i * vstride;
+}
+
+void genotype_set::compact() {
+	if (!sparse) return;
+	unsigned long n_entries = 0;
+	for (int i = 0 ; i < n_ind ; i ++) n_entries += bufferSparse[i].size();
+	arenaSparse = vector < unsigned int > (n_entries);
+	for (unsigned long i = 0, offset = 0 ; i < n_ind ; i ++) {
+		std::copy(bufferSparse[i].begin(), bufferSparse[i].end(), arenaSparse.begin() + offset);
+		vecG[i]->Sparse = arenaSparse.data() + offset;
+		vecG[i]->n_sparse = bufferSparse[i].size();
+		offset += bufferSparse[i].size();
+		vector < unsigned int > ().swap(bufferSparse[i]);
+	}
+	vector < vector < unsigned int > > ().swap(bufferSparse);
+	vrb.bullet("Sparse genotypes [" + stb.str(n_entries * 100.0 / ((unsigned long)n_ind * n_site), 2) + "% stored / mem=" + stb.str(n_entries * sizeof(unsigned int) * 1.0 / (1024 * 1024), 2) + "MB]");
+}
+
+void genotype_set::allocateNames(char ** names) {
+	unsigned long n_chars = 0;
+	vector < unsigned long > offsets = vector < unsigned long > (n_ind);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		offsets[i] = n_chars;
+		n_chars += strlen(names[i]) + 1;
+	}
+	arenaNames = vector < char > (n_chars);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		strcpy(&arenaNames[offsets[i]], names[i]);
+		vecG[i]->name = &arenaNames[offsets[i]];
+	}
+}
+
+void genotype_set::allocateSegments() {
+	unsigned long n_amb = 0, n_seg = 0;
+	for (int i = 0 ; i < n_ind ; i ++) {
+		n_amb += vecG[i]->n_ambiguous;
+		n_seg += vecG[i]->n_segments;
+	}
+	arenaAmbiguous = vector < unsigned char > (n_amb);
+	arenaDiplotypes = vector < unsigned long > (n_seg);
+	arenaLengths = vector < unsigned short > (n_seg);
+	for (unsigned long i = 0, aoffset = 0, soffset = 0 ; i < n_ind ; i ++) {
+		vecG[i]->Ambiguous = arenaAmbiguous.data() + aoffset;
+		vecG[i]->Diplotypes = arenaDiplotypes.data() + soffset;
+		vecG[i]->Lengths = arenaLengths.data() + soffset;
+		aoffset += vecG[i]->n_ambiguous;
+		soffset += vecG[i]->n_segments;
+	}
+}
+
+unsigned long genotype_set::sizeOfArenas() {
+	unsigned long size = storeG.size() * sizeof(genotype) + arenaNames.size();
+	size += n_ind * vstride + arenaSparse.size() * sizeof(unsigned int) + arenaAmbiguous.size();
+	size += arenaDiplotypes.size() * sizeof(unsigned long) + arenaLengths.size() * sizeof(unsigned short);
+	return size;
+}
+
 void genotype_set::imputeMonomorphic(variant_map & V) {
+	vector < unsigned int > C = vector < unsigned int > (vecG.size(), 0);
 	for (unsigned int v = 0 ; v < V.size() ; v ++) {
-		if (V.vec_pos[v]->isMonomorphic()) {
-			bool uallele = (V.vec_pos[v]->cref)?false:true;
+		if (V.isMonomorphic(v)) {
+			bool uallele = (V.vec_cref[v])?false:true;
 			for (unsigned int i = 0 ; i < vecG.size() ; i ++) {
-				VAR_SET_HOM(MOD2(v), vecG[i]->Variants[DIV2(v)]);
-				uallele?VAR_SET_HAP0(MOD2(v), vecG[i]->Variants[DIV2(v)]):VAR_CLR_HAP0(MOD2(v), vecG[i]->Variants[DIV2(v)]);
-				uallele?VAR_SET_HAP1(MOD2(v), vecG[i]->Variants[DIV2(v)]):VAR_CLR_HAP1(MOD2(v), vecG[i]->Variants[DIV2(v)]);
+				unsigned char code = vecG[i]->getCode(v, C[i]);
+				VAR_SET_HOM(0, code);
+				uallele?VAR_SET_HAP0(0, code):VAR_CLR_HAP0(0, code);
+				uallele?VAR_SET_HAP1(0, code):VAR_CLR_HAP1(0, code);
+				vecG[i]->setCode(v, C[i], code);
 			}
-			if (uallele) V.vec_pos[v]->cref = 0;
-			else V.vec_pos[v]->calt = 0;
-			V.vec_pos[v]->cmis = 0;
+			if (uallele) V.vec_cref[v] = 0;
+			else V.vec_calt[v] = 0;
+			V.vec_cmis[v] = 0;
 		}
 	}
 }
 
+unsigned long genotype_set::scaffold(variant_map & V, variant_map & VS, bitmatrix & HS) {
+	//Variants of VS are a subsequence of those of V (same input read with fewer variants kept), HS holds their haplotypes by variant
+	vector < unsigned int > C = vector < unsigned int > (vecG.size(), 0);
+	unsigned long n_scaffolded = 0;
+	for (unsigned int v = 0, s = 0 ; v < V.size() && s < VS.size() ; v ++) {
+		if (V.vec_bp[v] != VS.vec_bp[s] || strcmp(V.ref(v), VS.ref(s)) || strcmp(V.alt(v), VS.alt(s))) continue;
+		for (unsigned int i = 0 ; i < vecG.size() ; i ++) {
+			unsigned char code = vecG[i]->getCode(v, C[i]);
+			if (VAR_GET_MIS(0, code) || VAR_GET_HOM(0, code)) continue;
+			bool s0 = HS.get(s, 2*i+0), s1 = HS.get(s, 2*i+1);
+			if (s0 == s1) continue;
+			VAR_SET_SCA(0, code);
+			s0?VAR_SET_HAP0(0, code):VAR_CLR_HAP0(0, code);
+			s1?VAR_SET_HAP1(0, code):VAR_CLR_HAP1(0, code);
+			vecG[i]->setCode(v, C[i], code);
+			n_scaffolded ++;
+		}
+		s ++;
+	}
+	return n_scaffolded;
+}
+
 unsigned int genotype_set::largestNumberOfTransitions() {
 	unsigned int maxT = 0;
 	for (int i = 0 ; i < n_ind ; i ++) {
@@ -64,12 +201,68 @@ unsigned long genotype_set::numberOfSegments() {
 	return size;
 }
 
-void genotype_set::masking() {
-	for (int i = 0 ; i < n_ind ; i ++) vecG[i]->mask();
+void * masking_callback(void * ptr) {
+	genotype_set * S = static_cast< genotype_set * >( ptr );
+	for(;;) {
+		pthread_mutex_lock( &S->mutex_workers );
+		int curr_ind_to_process = S->i_workers++;
+		pthread_mutex_unlock( &S->mutex_workers);
+		if (curr_ind_to_process < S->n_ind) S->maskIndividual(curr_ind_to_process);
+		else pthread_exit(NULL);
+	}
+	return NULL;
+}
+
+void * solve_callback(void * ptr) {
+	genotype_set * S = static_cast< genotype_set * >( ptr );
+	for(;;) {
+		pthread_mutex_lock( &S->mutex_workers );
+		int curr_ind_to_process = S->i_workers++;
+		pthread_mutex_unlock( &S->mutex_workers);
+		if (curr_ind_to_process < S->n_ind) S->solveIndividual(curr_ind_to_process);
+		else pthread_exit(NULL);
+	}
+	return NULL;
+}
+
+void genotype_set::maskIndividual(unsigned int ind) {
+	std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+	vecG[ind]->mask();
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	pthread_mutex_lock(&mutex_workers);
+	statT.push(elapsed);
+	pthread_mutex_unlock(&mutex_workers);
+}
+
+void genotype_set::solveIndividual(unsigned int ind) {
+	std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+	vecG[ind]->solve();
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	pthread_mutex_lock(&mutex_workers);
+	statT.push(elapsed);
+	pthread_mutex_unlock(&mutex_workers);
+}
+
+void genotype_set::masking(int n_thread) {
+	tac.clock();
+	i_workers = 0;
+	statT.clear();
+	if (n_thread > 1) {
+		id_workers = vector < pthread_t > (n_thread);
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, masking_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+	} else for (int i = 0 ; i < n_ind ; i ++) maskIndividual(i);
+	vrb.bullet("PS masking [cpu=" + stb.str(statT.mean() * statT.size() / 1000, 2) + "s / ind=" + stb.str(statT.mean(), 2) + "+/-" + stb.str(statT.sd(), 2) + "ms] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
 
-void genotype_set::solve() {
+void genotype_set::solve(int n_thread) {
 	tac.clock();
-	for (int i = 0 ; i < vecG.size() ; i ++) vecG[i]->solve();
-	vrb.bullet("HAP solving (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	i_workers = 0;
+	statT.clear();
+	if (n_thread > 1) {
+		id_workers = vector < pthread_t > (n_thread);
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, solve_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+	} else for (int i = 0 ; i < n_ind ; i ++) solveIndividual(i);
+	vrb.bullet("HAP solving [cpu=" + stb.str(statT.mean() * statT.size() / 1000, 2) + "s / ind=" + stb.str(statT.mean(), 2) + "+/-" + stb.str(statT.sd(), 2) + "ms] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
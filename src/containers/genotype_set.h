@@ -25,24 +25,87 @@
 #include <utils/otools.h>
 
 #include <objects/genotype/genotype_header.h>
+#include <containers/bitmatrix.h>
 #include <containers/variant_map.h>
 
 class genotype_set {
 public:
 	//DATA
 	int n_site, n_ind;					//Number of variants, number of individuals
-	vector < genotype * > vecG;			//Vector of genotype graphs
+	bool sparse;						//Genotypes stored as lists of non hom-ref / ambiguous variants instead of dense arrays
+	vector < genotype * > vecG;			//Vector of genotype graphs (views into the cohort storage below)
+
+	//COHORT STORAGE (one contiguous arena per field, individuals address it through offsets)
+	vector < genotype > storeG;					//Genotype graphs, contiguous
+	unsigned char * arenaVariants;				//Variants of all individuals, vstride bytes each (dense encoding)
+	unsigned long vstride;						//Bytes per individual in arenaVariants; capacity while reading, DIV2(n_site)+MOD2(n_site) once finalised
+	vector < unsigned int > arenaSparse;		//Sparse entries of all individuals (sparse encoding)
+	vector < vector < unsigned int > > bufferSparse;	//Per individual sparse entries while reading, moved into arenaSparse by compact()
+	vector < unsigned char > arenaAmbiguous;	//Ambiguous of all individuals, n_ambiguous bytes each
+	vector < unsigned long > arenaDiplotypes;	//Diplotypes of all individuals, n_segments words each (as built)
+	vector < unsigned short > arenaLengths;		//Lengths of all individuals, n_segments shorts each (as built)
+	vector < char > arenaNames;					//Null-terminated sample names
+
+	//MULTI-THREADING
+	int i_workers;
+	pthread_mutex_t mutex_workers;
+	vector < pthread_t > id_workers;
+	basic_stats statT;					//Per individual running times (ms) of the last multi-threaded routine
 
 	//CONSTRUCTOR/DESTRUCTOR
 	genotype_set();
 	~genotype_set();
 
 	//METHODS
+	void allocate(unsigned int, unsigned int);	//Allocate the genotype graphs and the variant arena for n_ind individuals and an initial capacity of variants
+	void reserve(unsigned int);					//Grow the variant arena to a larger capacity of variants, keeping the variants already read
+	void finalise(unsigned int);				//Set the number of variants read and shrink the variant arena to it
+	void allocateNames(char **);				//Copy sample names into the names arena
+	void compact();								//Move the sparse entries read into the sparse arena
+	unsigned char getCode(unsigned int, unsigned int);			//Get code of a variant while reading (variants are read in order)
+	void setCode(unsigned int, unsigned int, unsigned char);	//Set code of a variant while reading (variants are read in order)
+	void setCodes(unsigned int, const unsigned char *);		//Set codes of a newly read variant for all individuals at once
+	void allocateSegments();					//Allocate the segment arenas once all genotype graphs have been counted
+	unsigned long sizeOfArenas();				//Memory used by the cohort arenas in bytes (used for verbose).
 	void imputeMonomorphic(variant_map &);		//Impute to REF monomorphic variants
+	unsigned long scaffold(variant_map &, variant_map &, bitmatrix &);	//Fix the phase of het genotypes from haplotypes phased on a subset of the variants
 	unsigned int largestNumberOfTransitions();	//Get the number of transitions in the larger genotype graph. Used to initialize memory space for multi-threading.
 	unsigned long numberOfSegments();			//Total number of segments across all genotype graphs (used for verbose).
-	void masking();								//Call function mask for all genotype graphs
-	void solve();								//Call function solve for all genotype graphs
+	void masking(int n_thread = 1);				//Call function mask for all genotype graphs
+	void solve(int n_thread = 1);				//Call function solve for all genotype graphs
+	void maskIndividual(unsigned int);			//Call function mask for one genotype graph and time it
+	void solveIndividual(unsigned int);			//Call function solve for one genotype graph and time it
 };
 
+inline
+unsigned char genotype_set::getCode(unsigned int ind, unsigned int v) {
+	if (!sparse) return (vecG[ind]->Variants[DIV2(v)] >> (MOD2(v) << 2)) & 15U;
+	vector < unsigned int > & B = bufferSparse[ind];
+	return (!B.empty() && SPA_SITE(B.back()) == v)?SPA_CODE(B.back()):0;
+}
+
+inline
+void genotype_set::setCode(unsigned int ind, unsigned int v, unsigned char code) {
+	if (!sparse) {
+		unsigned int c = 0;
+		vecG[ind]->setCode(v, c, code);
+	} else {
+		vector < unsigned int > & B = bufferSparse[ind];
+		if (!B.empty() && SPA_SITE(B.back()) == v) B.back() = SPA_MAKE(v, code);
+		else if (code) B.push_back(SPA_MAKE(v, code));
+	}
+}
+
+inline
+void genotype_set::setCodes(unsigned int v, const unsigned char * codes) {
+	if (!sparse) {
+		//Nibbles of a newly read variant are still 0 in the arena, so codes are OR-ed in at the individual stride
+		unsigned char * p = arenaVariants + DIV2(v);
+		unsigned int shift = MOD2(v) << 2;
+		for (unsigned int i = 0 ; i < n_ind ; i ++, p += vstride) *p |= codes[i] << shift;
+	} else {
+		for (unsigned int i = 0 ; i < n_ind ; i ++) if (codes[i]) bufferSparse[i].push_back(SPA_MAKE(v, codes[i]));
+	}
+}
+
 #endif
@@ -26,9 +26,14 @@ haplotype_set::haplotype_set() {
 	n_hap = 0;
 	n_ind = 0;
 	n_save = 0;
+	n_thread = 1;
+	i_workers = 0;
+	G_update = NULL;
+	full_update = false;
 }
 
 haplotype_set::~haplotype_set() {
+	if (n_thread > 1) pthread_mutex_destroy(&mutex_workers);
 	n_site = 0;
 	n_hap = 0;
 	n_ind = 0;
@@ -42,16 +47,26 @@ haplotype_set::~haplotype_set() {
 
 void haplotype_set::updateMapping() {
 	rel_indexes.clear();
+	save_locus.clear();
 	int rint = rng.getInt(mod);
-	for (int l = 0 ; l < abs_indexes.size() ; l ++) rel_indexes.push_back(((l%mod == rint)?(l/mod):(-1)));
+	for (int l = 0 ; l < abs_indexes.size() ; l ++) {
+		rel_indexes.push_back(((l%mod == rint)?(l/mod):(-1)));
+		if (rel_indexes.back() >= 0) save_locus.push_back(abs_indexes[l]);
+	}
 }
 
-void haplotype_set::allocate(variant_map & V, int _mod, int _depth) {
+void haplotype_set::allocate(variant_map & V, int _mod, int _depth, int _n_thread) {
 	mod = _mod;
 	depth = _depth;
-	for (int al = 0, rl = 0 ; al < n_site ; al ++) if (V.vec_pos[al]->getMAC() >= 2) {
+	n_thread = _n_thread;
+	if (n_thread > 1) {
+		id_workers = vector < pthread_t > (n_thread);
+		pthread_mutex_init(&mutex_workers, NULL);
+	}
+	for (int al = 0, rl = 0 ; al < n_site ; al ++) if (V.getMAC(al) >= 2) {
 		abs_indexes.push_back(al);
 		rel_indexes.push_back(((rl%mod)?(-1):(rl/mod)));
+		if (rl%mod == 0) save_locus.push_back(al);
 		rl++;
 	}
 	n_save = (abs_indexes.size() / mod) + (abs_indexes.size() % mod != 0);
@@ -60,18 +75,107 @@ void haplotype_set::allocate(variant_map & V, int _mod, int _depth) {
 	dist_clusters = vector < int > (2 * n_hap, 0);
 }
 
-void haplotype_set::update(genotype_set & G, bool first_time) {
-	tac.clock();
-	for (unsigned int i = 0 ; i < G.n_ind ; i ++) {
-		for (unsigned int v = 0 ; v < n_site ; v ++) {
-			if (first_time || (VAR_GET_AMB(MOD2(v), G.vecG[i]->Variants[DIV2(v)]))) {
-				bool a0 = VAR_GET_HAP0(MOD2(v), G.vecG[i]->Variants[DIV2(v)]);
-				bool a1 = VAR_GET_HAP1(MOD2(v), G.vecG[i]->Variants[DIV2(v)]);
-				H_opt_hap.set(2*i+0, v, a0);
-				H_opt_hap.set(2*i+1, v, a1);
+void * update_callback(void * ptr) {
+	haplotype_set * S = static_cast< haplotype_set * >( ptr );
+	for(;;) {
+		pthread_mutex_lock( &S->mutex_workers );
+		int curr_ind_to_process = S->i_workers++;
+		pthread_mutex_unlock( &S->mutex_workers);
+		if (curr_ind_to_process < S->G_update->n_ind) S->update(curr_ind_to_process);
+		else pthread_exit(NULL);
+	}
+	return NULL;
+}
+
+/*
+ * Pushes the haplotypes of individual ind into rows 2*ind and 2*ind+1 of H_opt_hap, 64 variants at a time.
+ * In the sparse encoding, only stored variants are visited (rows are cleared first on a full update).
+ * Each byte of Variants packs 2 variants (see VAR_* macros) and is converted into 2 bits of each of the two 64-bit
+ * haplotype words, laid out as the bytes of H_opt_hap (i.e. first variant of a byte on its most significant bit).
+ * When full_update is false, blocks without any ambiguous variant are skipped and only ambiguous bits are written.
+ */
+void haplotype_set::update(unsigned int ind) {
+	genotype * g = G_update->vecG[ind];
+	if (g->Sparse) {
+		if (full_update) {
+			memset(H_opt_hap.bytes + (2UL*ind+0) * (H_opt_hap.n_cols / 8), 0, H_opt_hap.n_cols / 8);
+			memset(H_opt_hap.bytes + (2UL*ind+1) * (H_opt_hap.n_cols / 8), 0, H_opt_hap.n_cols / 8);
+		}
+		for (unsigned int e = 0 ; e < g->n_sparse ; e ++) {
+			unsigned char code = SPA_CODE(g->Sparse[e]);
+			if (!full_update && !VAR_GET_AMB(0, code)) continue;
+			int v = SPA_SITE(g->Sparse[e]);
+			for (int h = 0 ; h < 2 ; h ++) {
+				bool a = h?VAR_GET_HAP1(0, code):VAR_GET_HAP0(0, code);
+				if (!full_update && H_opt_hap.get(2*ind+h, v) != a) {
+					dirty_first[2*ind+h] = min(dirty_first[2*ind+h], v & ~63);
+					dirty_last[2*ind+h] = max(dirty_last[2*ind+h], v | 63);
+				}
+				H_opt_hap.set(2*ind+h, v, a);
 			}
 		}
+		return;
 	}
+	const unsigned char * variants = g->Variants;
+	unsigned long n_vbytes = DIV2(g->n_variants) + MOD2(g->n_variants);
+	unsigned long n_rbytes = H_opt_hap.n_cols / 8;
+	unsigned char * row0 = H_opt_hap.bytes + (2UL*ind+0) * n_rbytes;
+	unsigned char * row1 = H_opt_hap.bytes + (2UL*ind+1) * n_rbytes;
+	unsigned char vblock [32];
+	for (unsigned long v = 0 ; v < n_site ; v += 64) {
+		//1. Load the 32 bytes of Variants covering variants [v, v+64), zero padded at the end
+		unsigned long vbyte = v / 2, n_curr_vbytes = min(32UL, n_vbytes - vbyte);
+		const unsigned char * vptr = variants + vbyte;
+		if (n_curr_vbytes < 32) {
+			memset(vblock, 0, 32);
+			memcpy(vblock, vptr, n_curr_vbytes);
+			vptr = vblock;
+		}
+		if (!full_update) {
+			unsigned long wvar[4], wtype = 0;
+			memcpy(wvar, vptr, 32);
+			for (int w = 0 ; w < 4 ; w ++) wtype |= (wvar[w] & 0x3333333333333333UL);
+			if (!wtype) continue;
+		}
+
+		//2. Convert into haplotype words
+		unsigned long hap0 = 0, hap1 = 0, amb = 0;
+		for (unsigned int b = 0 ; b < 32 ; b ++) {
+			unsigned char byte = vptr[b];
+			unsigned int shift = 8 * (b >> 2) + 6 - 2 * (b & 3);
+			hap0 |= ((unsigned long)(VAR_GET_HAP0(0, byte) << 1 | VAR_GET_HAP0(1, byte))) << shift;
+			hap1 |= ((unsigned long)(VAR_GET_HAP1(0, byte) << 1 | VAR_GET_HAP1(1, byte))) << shift;
+			amb |= ((unsigned long)(VAR_GET_AMB(0, byte) << 1 | VAR_GET_AMB(1, byte))) << shift;
+		}
+
+		//3. Write haplotype words
+		unsigned long rbyte = v / 8, n_curr_rbytes = min(8UL, n_rbytes - rbyte);
+		if (!full_update) {
+			unsigned long prev0 = 0, prev1 = 0;
+			memcpy(&prev0, row0 + rbyte, n_curr_rbytes);
+			memcpy(&prev1, row1 + rbyte, n_curr_rbytes);
+			hap0 = (prev0 & ~amb) | (hap0 & amb);
+			hap1 = (prev1 & ~amb) | (hap1 & amb);
+			if (hap0 != prev0) { dirty_first[2*ind+0] = min(dirty_first[2*ind+0], (int)v); dirty_last[2*ind+0] = v + 63; }
+			if (hap1 != prev1) { dirty_first[2*ind+1] = min(dirty_first[2*ind+1], (int)v); dirty_last[2*ind+1] = v + 63; }
+		}
+		memcpy(row0 + rbyte, &hap0, n_curr_rbytes);
+		memcpy(row1 + rbyte, &hap1, n_curr_rbytes);
+	}
+}
+
+void haplotype_set::update(genotype_set & G, bool first_time) {
+	tac.clock();
+	G_update = &G;
+	full_update = first_time;
+	dirty_first = vector < int > (2 * n_ind, first_time?0:std::numeric_limits < int >::max());
+	dirty_last = vector < int > (2 * n_ind, first_time?std::numeric_limits < int >::max():-1);
+	if (n_thread > 1) {
+		i_workers = 0;
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, update_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+	} else for (unsigned int i = 0 ; i < G.n_ind ; i ++) update(i);
+	G_update = NULL;
 	vrb.bullet("HAP update (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
 
@@ -89,6 +193,13 @@ void haplotype_set::transposeV2H(bool full) {
 	vrb.bullet("V2H transpose (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
 
+void haplotype_set::transposeReferenceV2H() {
+	if (n_hap == 2 * n_ind) return;
+	tac.clock();
+	H_opt_var.transpose(H_opt_hap, n_site, 2*n_ind, n_hap);
+	vrb.bullet("V2H transpose [reference] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
 void haplotype_set::transposeC2H() {
 	tac.clock();
 	int block = 32;
@@ -110,6 +221,7 @@ void haplotype_set::transposeC2H() {
 }
 
 void haplotype_set::select() {
+	if (PR.built()) return selectWithReference();
 	tac.clock();
 	updateMapping();
 	int iprev = 1, inext = 0, i_added = 0;
@@ -193,6 +305,130 @@ void haplotype_set::select() {
 	vrb.bullet("PBWT selection (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
 
+void haplotype_set::buildReferencePBWT(variant_map & V, string cache) {
+	unsigned long n_ref = n_hap - 2 * n_ind;
+	if (n_ref == 0) return;
+	//FNV-1a checksum of the selection sites and of the reference haplotypes at these sites
+	unsigned long key = 14695981039346656037UL;
+	const unsigned long n_rbytes = H_opt_var.n_cols / 8;
+	for (int l = 0 ; l < abs_indexes.size() ; l ++) {
+		unsigned long bp = V.vec_bp[abs_indexes[l]];
+		for (int b = 0 ; b < 4 ; b ++) key = (key ^ ((bp >> (8 * b)) & 0xFF)) * 1099511628211UL;
+		const unsigned char * row = H_opt_var.bytes + abs_indexes[l] * n_rbytes;
+		for (unsigned long c = 2 * n_ind ; c < n_hap ; c ++) key = (key ^ ((row[c / 8] >> (7 - c % 8)) & 1)) * 1099511628211UL;
+	}
+	if (cache.empty() || !PR.load(cache, n_ref, abs_indexes.size(), key)) {
+		PR.build(H_opt_var, abs_indexes, 2 * n_ind, n_ref, key);
+		if (!cache.empty()) PR.save(cache);
+	}
+}
+
+/*
+ * Same selection as select, but only the 2*n_ind target haplotypes are sorted at each site. The full PBWT order is the
+ * merge of the target order with the stored reference order (both sub-orders are stable partitions of the full one),
+ * so each target only carries its insertion point G among the reference haplotypes, together with the starts of its
+ * matches with the reference haplotypes just before (DP) and after (DN) this point. Divergences between any two
+ * haplotypes are then maxima of consecutive divergences in either sub-order, which gives the same neighbours and the
+ * same match lengths as the sweep on all haplotypes, at a cost scaling with the number of targets.
+ */
+void haplotype_set::selectWithReference() {
+	tac.clock();
+	updateMapping();
+	const int n_tar = 2 * n_ind, n_ref = PR.n_ref;
+	unsigned long addr_offset = n_save * (unsigned long)n_ind * 2UL;
+	vector < int > T = vector < int >(n_tar), TD = vector < int >(n_tar, 0);
+	vector < int > B = vector < int >(n_tar, 0), D = vector < int >(n_tar, 0);
+	vector < int > G = vector < int >(n_tar, 0), DP = vector < int >(n_tar, 0), DN = vector < int >(n_tar, 0);
+	vector < int > div0 = vector < int >(n_ref, 0);
+	for (int t = 0 ; t < n_tar ; t ++) T[t] = t;
+	for (int l = 0 ; l < abs_indexes.size() ; l ++) {
+		const int * pdiv = l?&PR.div[(l-1) * (unsigned long)n_ref]:&div0[0];
+		int curr_block = abs_indexes[l] / lengthIBD2;
+
+		//1. Carry the insertion points of the targets and sort the targets
+		int u = 0, v = 0, p = l, q = l;
+		for (int ti = 0 ; ti < n_tar ; ti ++) {
+			int t = T[ti], g = G[t];
+			bool a = H_opt_var.get(abs_indexes[l], t);
+			int mx = DP[t], k = g - 1;
+			for (; k >= 0 && PR.get(l, k) != a ; k --) mx = max(mx, pdiv[k]);
+			DP[t] = (k >= 0)?mx:l;
+			mx = DN[t]; k = g;
+			while (k < n_ref && PR.get(l, k) != a) if (++k < n_ref) mx = max(mx, pdiv[k]);
+			DN[t] = (k < n_ref)?mx:l;
+			unsigned int r0 = PR.rank0(l, g);
+			G[t] = a?(PR.n_zero[l] + g - r0):r0;
+			if (TD[ti] > p) p = TD[ti];
+			if (TD[ti] > q) q = TD[ti];
+			if (!a) {
+				T[u] = t;
+				TD[u] = p;
+				p = 0;
+				u++;
+			} else {
+				B[v] = t;
+				D[v] = q;
+				q = 0;
+				v++;
+			}
+		}
+		std::copy(B.begin(), B.begin()+v, T.begin()+u);
+		std::copy(D.begin(), D.begin()+v, TD.begin()+u);
+
+		//2. Conditioning haplotypes, walking the merged order on both sides of each target
+		if (rel_indexes[l] >= 0) {
+			const int * rorder = &PR.order[l * (unsigned long)n_ref], * rdiv = &PR.div[l * (unsigned long)n_ref];
+			for (int ti = 0 ; ti < n_tar ; ti ++) {
+				int chap = T[ti], cind = chap / 2, g = G[chap];
+				unsigned long tar_idx = ((unsigned long)rel_indexes[l])*2*n_ind + chap;
+				//Left cursor: next target tl (while inserted after reference rl) or reference rl; right cursor likewise
+				int tl = ti - 1, rl = g - 1, mtl = 0, mrl = DP[chap], hap0 = -1, lmatch0 = l;
+				int tr = ti + 1, rr = g, mtr = 0, mrr = DN[chap], hap1 = -1, lmatch1 = l;
+				bool next0 = true, next1 = true, add0, add1;
+				for (int n_added = 0 ; n_added < depth ; ) {
+					if (next0) {
+						if (tl >= 0 && G[T[tl]] > rl) { mtl = max(mtl, TD[tl+1]); hap0 = T[tl--]; lmatch0 = mtl; }
+						else if (rl >= 0) { hap0 = n_tar + rorder[rl]; lmatch0 = mrl; mrl = max(mrl, rdiv[rl--]); }
+						else { hap0 = -1; lmatch0 = l; }
+						next0 = false;
+					}
+					if (next1) {
+						if (tr < n_tar && G[T[tr]] <= rr) { mtr = max(mtr, TD[tr]); hap1 = T[tr++]; lmatch1 = mtr; }
+						else if (rr < n_ref) { hap1 = n_tar + rorder[rr]; lmatch1 = mrr; if (++rr < n_ref) mrr = max(mrr, rdiv[rr]); }
+						else { hap1 = -1; lmatch1 = l; }
+						next1 = false;
+					}
+					if (hap0 < 0 && hap1 < 0) break;
+					add0 = (hap0 >= 0) && (hap0/2 != cind);
+					if (add0 && flagIBD2[curr_block][cind]) add0 = !banned(curr_block, cind, hap0/2);
+					add1 = (hap1 >= 0) && (hap1/2 != cind);
+					if (add1 && flagIBD2[curr_block][cind]) add1 = !banned(curr_block, cind, hap1/2);
+					if (add0 && add1) {
+						if (lmatch0 < lmatch1 || (lmatch0 == lmatch1 && rng.flipCoin())) {
+							save_clusters[n_added*addr_offset+tar_idx] = hap0;
+							next0 = true; n_added++;
+						} else {
+							save_clusters[n_added*addr_offset+tar_idx] = hap1;
+							next1 = true; n_added++;
+						}
+					} else if (add0) {
+						save_clusters[n_added*addr_offset+tar_idx] = hap0;
+						next0 = true; n_added++;
+					} else if (add1) {
+						save_clusters[n_added*addr_offset+tar_idx] = hap1;
+						next1 = true; n_added++;
+					} else {
+						next0 = true;
+						next1 = true;
+					}
+				}
+			}
+		}
+		vrb.progress("  * PBWT selection", (l+1)*1.0/abs_indexes.size());
+	}
+	vrb.bullet("PBWT selection [targets] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
 void haplotype_set::searchIBD2(int _lengthIBD2) {
 	tac.clock();
 	lengthIBD2 = _lengthIBD2;
@@ -27,6 +27,7 @@
 #include <containers/bitmatrix.h>
 #include <containers/genotype_set.h>
 #include <containers/variant_map.h>
+#include <containers/pbwt_reference.h>
 
 class haplotype_set {
 public:
@@ -41,27 +42,43 @@ public:
 	bitmatrix H_opt_hap;		// Bit matrix of haplotypes (haplotype first)
 	bitmatrix H_opt_var;		// Bit matrix of haplotypes (variant first). Transposed version of H_opt_hap
 	vector < int > abs_indexes, rel_indexes;	//Variant indexing for stored PBWT indexes
+	vector < int > save_locus;					//Variant of each stored PBWT index, increasing (rel_indexes inverted)
 	vector < int > curr_clusters, dist_clusters, save_clusters;
+	pbwt_reference PR;			// PBWT of the reference haplotypes alone, targets are inserted into it by select when built
+	vector < int > dirty_first, dirty_last;		// Variants whose alleles changed at the last update, per target haplotype, 64-variant aligned (first > last when none)
 
 	//IBD2
 	vector < vector < bool > > flagIBD2;				//IBD2 constrains on the copying process, binary form
 	vector < vector < pair < int, int > > > idxIBD2;	//IBD2 constrains on the copying process, index form
 
+	//MULTI-THREADING
+	int n_thread;
+	int i_workers;
+	pthread_mutex_t mutex_workers;
+	vector < pthread_t > id_workers;
+	genotype_set * G_update;		//Genotype graphs being pushed into H_opt_hap by the workers of update
+	bool full_update;				//Whether all sites (true) or only ambiguous ones (false) are pushed
+
 	//CONSTRUCTOR/DESTRUCTOR/INITIALIZATION
 	haplotype_set();
 	~haplotype_set();
 
 	//ROUTINES
-	void allocate(variant_map &, int, int);
+	void allocate(variant_map &, int, int, int n_thread = 1);
 	void update(genotype_set & G, bool first_time = false);
+	void update(unsigned int);
 	void select();
+	void selectWithReference();
+	void buildReferencePBWT(variant_map &, string cache = "");
 	void transposeH2V(bool full);								//Transpose Haplotype bit matrixes
 	void transposeV2H(bool full);								//Transpose Haplotype bit matrixes
+	void transposeReferenceV2H();								//Transpose the reference haplotypes only, read directly into H_opt_var
 	void transposeC2H();
 	void updateMapping();
 
 	void searchIBD2(int);
 	bool banned(int, int, int);
+	bool dirty(vector < unsigned int > &, int, int);
 };
 
 inline
@@ -72,4 +89,10 @@ bool haplotype_set::banned(int b, int _i0, int _i1) {
 	return false;
 }
 
+inline
+bool haplotype_set::dirty(vector < unsigned int > & K, int first, int last) {
+	for (unsigned int k = 0 ; k < K.size() ; k ++) if (K[k] < 2 * n_ind && dirty_first[K[k]] <= last && dirty_last[K[k]] >= first) return true;
+	return false;
+}
+
 #endif
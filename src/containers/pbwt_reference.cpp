@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <containers/pbwt_reference.h>
+
+static const char pbwt_magic [8] = { 'S', 'H', 'P', '4', 'P', 'B', 'W', 1 };
+
+pbwt_reference::pbwt_reference() {
+	n_ref = n_col = n_word = key = 0;
+}
+
+pbwt_reference::~pbwt_reference() {
+	clear();
+}
+
+void pbwt_reference::clear() {
+	n_ref = n_col = n_word = 0;
+	vector < int > ().swap(order);
+	vector < int > ().swap(div);
+	vector < unsigned long > ().swap(bits);
+	vector < unsigned int > ().swap(zeros);
+	vector < unsigned int > ().swap(n_zero);
+}
+
+unsigned long pbwt_reference::sizeOf() {
+	return (order.size() + div.size()) * sizeof(int) + bits.size() * sizeof(unsigned long) + (zeros.size() + n_zero.size()) * sizeof(unsigned int);
+}
+
+/*
+ * Sweeps the reference haplotypes (columns [ref_offset, ref_offset + n_ref) of H_opt_var) through the rows listed in
+ * sites, exactly as haplotype_set::select does on all haplotypes, and keeps the state of every column.
+ */
+void pbwt_reference::build(bitmatrix & H_opt_var, vector < int > & sites, unsigned long ref_offset, unsigned long _n_ref, unsigned long _key) {
+	tac.clock();
+	n_ref = _n_ref;
+	n_col = sites.size();
+	n_word = n_ref / 64 + (n_ref % 64 != 0);
+	key = _key;
+	order = vector < int > (n_col * n_ref);
+	div = vector < int > (n_col * n_ref);
+	bits = vector < unsigned long > (n_col * n_word, 0UL);
+	zeros = vector < unsigned int > (n_col * n_word, 0);
+	n_zero = vector < unsigned int > (n_col, 0);
+	vector < int > B = vector < int >(n_ref, 0);
+	vector < int > D = vector < int >(n_ref, 0);
+	for (unsigned long l = 0 ; l < n_col ; l ++) {
+		int u = 0, v = 0, p = l, q = l;
+		int * curr_order = &order[l * n_ref], * curr_div = &div[l * n_ref];
+		unsigned long * curr_bits = &bits[l * n_word];
+		for (unsigned long h = 0 ; h < n_ref ; h ++) {
+			int alookup = l?order[(l-1) * n_ref + h]:h;
+			int dlookup = l?div[(l-1) * n_ref + h]:0;
+			if (dlookup > p) p = dlookup;
+			if (dlookup > q) q = dlookup;
+			if (!H_opt_var.get(sites[l], ref_offset + alookup)) {
+				curr_order[u] = alookup;
+				curr_div[u] = p;
+				p = 0;
+				u++;
+			} else {
+				curr_bits[h / 64] |= 1UL << (h % 64);
+				B[v] = alookup;
+				D[v] = q;
+				q = 0;
+				v++;
+			}
+		}
+		std::copy(B.begin(), B.begin()+v, order.begin() + l * n_ref + u);
+		std::copy(D.begin(), D.begin()+v, div.begin() + l * n_ref + u);
+		n_zero[l] = u;
+		for (unsigned long w = 1 ; w < n_word ; w ++) zeros[l * n_word + w] = zeros[l * n_word + w - 1] + 64 - __builtin_popcountl(curr_bits[w - 1]);
+		vrb.progress("  * PBWT reference", (l+1)*1.0/n_col);
+	}
+	vrb.bullet("PBWT reference [Nr=" + stb.str(n_ref) + " / L=" + stb.str(n_col) + " / mem=" + stb.str(sizeOf() * 1.0 / (1024 * 1024), 2) + "MB] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+bool pbwt_reference::load(string fname, unsigned long _n_ref, unsigned long _n_col, unsigned long _key) {
+	tac.clock();
+	n_ref = _n_ref;
+	n_col = _n_col;
+	n_word = n_ref / 64 + (n_ref % 64 != 0);
+	key = _key;
+	std::ifstream fd (fname.c_str(), std::ios::in | std::ios::binary);
+	if (!fd.is_open()) { clear(); return false; }
+	char magic [8];
+	unsigned long header [3], file_key;
+	bool valid = fd.read(magic, 8) && !memcmp(magic, pbwt_magic, 8);
+	valid = valid && fd.read(reinterpret_cast < char * > (&file_key), sizeof(unsigned long)) && file_key == key;
+	valid = valid && fd.read(reinterpret_cast < char * > (header), 3 * sizeof(unsigned long));
+	valid = valid && header[0] == n_ref && header[1] == n_col && header[2] == n_word;
+	if (!valid) {
+		vrb.bullet("PBWT reference cache [" + fname + "] does not match the current sites and reference haplotypes");
+		clear();
+		return false;
+	}
+	order = vector < int > (n_col * n_ref);
+	div = vector < int > (n_col * n_ref);
+	bits = vector < unsigned long > (n_col * n_word);
+	zeros = vector < unsigned int > (n_col * n_word);
+	n_zero = vector < unsigned int > (n_col);
+	fd.read(reinterpret_cast < char * > (order.data()), order.size() * sizeof(int));
+	fd.read(reinterpret_cast < char * > (div.data()), div.size() * sizeof(int));
+	fd.read(reinterpret_cast < char * > (bits.data()), bits.size() * sizeof(unsigned long));
+	fd.read(reinterpret_cast < char * > (zeros.data()), zeros.size() * sizeof(unsigned int));
+	fd.read(reinterpret_cast < char * > (n_zero.data()), n_zero.size() * sizeof(unsigned int));
+	if (!fd) { clear(); return false; }
+	vrb.bullet("PBWT reference [Nr=" + stb.str(n_ref) + " / L=" + stb.str(n_col) + " / loaded from " + fname + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	return true;
+}
+
+void pbwt_reference::save(string fname) {
+	std::ofstream fd (fname.c_str(), std::ios::out | std::ios::binary);
+	if (!fd.is_open()) vrb.error("Impossible to create [" + fname + "]");
+	unsigned long header [3] = { n_ref, n_col, n_word };
+	fd.write(pbwt_magic, 8);
+	fd.write(reinterpret_cast < char * > (&key), sizeof(unsigned long));
+	fd.write(reinterpret_cast < char * > (header), 3 * sizeof(unsigned long));
+	fd.write(reinterpret_cast < char * > (order.data()), order.size() * sizeof(int));
+	fd.write(reinterpret_cast < char * > (div.data()), div.size() * sizeof(int));
+	fd.write(reinterpret_cast < char * > (bits.data()), bits.size() * sizeof(unsigned long));
+	fd.write(reinterpret_cast < char * > (zeros.data()), zeros.size() * sizeof(unsigned int));
+	fd.write(reinterpret_cast < char * > (n_zero.data()), n_zero.size() * sizeof(unsigned int));
+	fd.close();
+	if (fd.fail()) vrb.error("Non zero status when closing [" + fname + "]");
+	vrb.bullet("PBWT reference saved in [" + fname + "]");
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _PBWT_REFERENCE_H
+#define _PBWT_REFERENCE_H
+
+#include <utils/otools.h>
+
+#include <containers/bitmatrix.h>
+
+/*
+ * PBWT of the reference haplotypes alone over the selection sites (variants with MAC >= 2), computed once as these
+ * haplotypes never change across iterations. For column l, it stores:
+ * - order: reference haplotypes sorted after column l,
+ * - div: start of the match of each of them with its predecessor in order (last mismatch, 0 if none),
+ * - bits: alleles at column l, in the order of column l-1 (identity for l=0), with the number of 0s preceding
+ *   each 64-bit word so that the insertion point of any other haplotype can be carried from column to column.
+ * Memory is 8 bytes per reference haplotype and column, this can be persisted in a cache file keyed by a checksum
+ * of the sites and reference haplotypes.
+ */
+class pbwt_reference {
+public:
+	unsigned long n_ref;					//#reference haplotypes
+	unsigned long n_col;					//#columns (selection sites)
+	unsigned long n_word;					//#64-bit words per column of bits
+	unsigned long key;						//Checksum of sites and reference haplotypes
+	vector < int > order;					//[n_col x n_ref]
+	vector < int > div;						//[n_col x n_ref]
+	vector < unsigned long > bits;			//[n_col x n_word]
+	vector < unsigned int > zeros;			//[n_col x n_word], #0s in bits before each word
+	vector < unsigned int > n_zero;			//[n_col], #0s in each column
+
+	pbwt_reference();
+	~pbwt_reference();
+
+	bool built();
+	void clear();
+	void build(bitmatrix &, vector < int > &, unsigned long, unsigned long, unsigned long);
+	bool load(string, unsigned long, unsigned long, unsigned long);
+	void save(string);
+	unsigned long sizeOf();
+	bool get(unsigned long, unsigned long);
+	unsigned int rank0(unsigned long, unsigned long);
+};
+
+inline
+bool pbwt_reference::built() {
+	return n_col > 0;
+}
+
+inline
+bool pbwt_reference::get(unsigned long l, unsigned long i) {
+	return (bits[l * n_word + i / 64] >> (i % 64)) & 1UL;
+}
+
+//Number of 0s among the first i haplotypes of column l, in the order of column l-1
+inline
+unsigned int pbwt_reference::rank0(unsigned long l, unsigned long i) {
+	if (i == n_ref) return n_zero[l];
+	unsigned long w = i / 64, r = i % 64;
+	unsigned int n = zeros[l * n_word + w];
+	if (r) n += r - __builtin_popcountl(bits[l * n_word + w] & ((1UL << r) - 1));
+	return n;
+}
+
+#endif
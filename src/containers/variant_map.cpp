@@ -20,52 +20,63 @@
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
 
+#define _GLOBAL
 #include <containers/variant_map.h>
 
 variant_map::variant_map() {
 }
 
 variant_map::~variant_map() {
-	for (int s = 0 ; s < vec_pos.size() ; s++) delete vec_pos[s];
-	vec_pos.clear();
-	map_pos.clear();
+	chrs.clear();
+	vector < unsigned short > ().swap(vec_chr);
+	vector < int > ().swap(vec_bp);
+	vector < double > ().swap(vec_cm);
+	vector < unsigned int > ().swap(vec_cref);
+	vector < unsigned int > ().swap(vec_calt);
+	vector < unsigned int > ().swap(vec_cmis);
+	vector < unsigned long > ().swap(vec_str);
+	vector < char > ().swap(pool);
 }
 
-int variant_map::size() {
-	return vec_pos.size();
+void variant_map::push(const char * chr, int bp, const char * id, const char * ref, const char * alt, unsigned int cref, unsigned int calt, unsigned int cmis) {
+	//Variants come sorted by chromosome, so the last interned name is nearly always the right one
+	int c = chrs.size() - 1;
+	if (c < 0 || chrs[c] != chr) {
+		for (c = 0 ; c < chrs.size() && chrs[c] != chr ; c ++);
+		if (c == chrs.size()) chrs.push_back(string(chr));
+	}
+	vec_chr.push_back(c);
+	vec_bp.push_back(bp);
+	vec_cm.push_back(-1.0);
+	vec_cref.push_back(cref);
+	vec_calt.push_back(calt);
+	vec_cmis.push_back(cmis);
+	vec_str.push_back(pool.size());
+	pool.insert(pool.end(), id, id + strlen(id) + 1);
+	pool.insert(pool.end(), ref, ref + strlen(ref) + 1);
+	pool.insert(pool.end(), alt, alt + strlen(alt) + 1);
 }
 
-variant * variant_map::getByIndex (int i) {
-	return vec_pos[i];
+void variant_map::shrink() {
+	vec_chr.shrink_to_fit();
+	vec_bp.shrink_to_fit();
+	vec_cm.shrink_to_fit();
+	vec_cref.shrink_to_fit();
+	vec_calt.shrink_to_fit();
+	vec_cmis.shrink_to_fit();
+	vec_str.shrink_to_fit();
+	pool.shrink_to_fit();
 }
 
-vector < variant * > variant_map::getByPos (int pos) {
-	vector < variant * > vecS;
-	pair < multimap < int , variant * >::iterator , multimap < int , variant * >::iterator > ret = map_pos.equal_range(pos);
-	for (multimap < int , variant * >::iterator it = ret.first ; it != ret.second ; ++it) vecS.push_back(it->second);
-	return vecS;
-}
-
-vector < variant * > variant_map::getByRef(int pos, string & ref, string & alt) {
-	vector < variant * > vecS = vector < variant * >();
-	pair < multimap < int , variant * >::iterator , multimap < int , variant * >::iterator > ret = map_pos.equal_range(pos);
-	for (multimap < int , variant * >::iterator it = ret.first ; it != ret.second ; ++it) {
-		if (it->second->ref == ref && it->second->alt == alt) vecS.push_back(it->second);
-	}
-	return vecS;
-}
-
-void variant_map::push(variant * v) {
-	vec_pos.push_back(v);
-	map_pos.insert(pair < int , variant * > (v->bp, v));
+int variant_map::lowerBound(int bp) {
+	return std::lower_bound(vec_bp.begin(), vec_bp.end(), bp) - vec_bp.begin();
 }
 
 int variant_map::setCentiMorgan(vector < int > & pos_bp, vector < double > & pos_cM) {
 	int cpt = 0;
 	for (int l = 0 ; l < pos_cM.size() ; l ++) {
-		vector  < variant * > vecS = getByPos(pos_bp[l]);
-		for (int si = 0 ; si < vecS.size() ; si ++) {
-			vecS[si]->cm = pos_cM[l];
+		for (int s = lowerBound(pos_bp[l]) ; s < vec_bp.size() && vec_bp[s] == pos_bp[l] ; s ++) {
+			vec_cm[s] = pos_cM[l];
 			cpt++;
 		}
 	}
@@ -75,32 +86,38 @@ int variant_map::setCentiMorgan(vector < int > & pos_bp, vector < double > & pos
 int variant_map::interpolateCentiMorgan(vector < int > & pos_bp, vector < double > & pos_cM) {
 	int cpt = 0;
 	double mean_rate = (pos_cM.back() - pos_cM[0]) / (pos_bp.back() - pos_bp[0]);
-	for (int s = 0 ; s < vec_pos.size() ; s ++) {
-		if (vec_pos[s]->cm < 0) {
-			if (vec_pos[s]->bp < pos_bp[0]) vec_pos[s]->cm = pos_cM[0] - mean_rate * (pos_bp[0] - vec_pos[s]->bp);
-			else if (vec_pos[s]->bp > pos_bp.back()) vec_pos[s]->cm = pos_cM.back() + mean_rate * (vec_pos[s]->bp - pos_bp.back());
+	//Merge-join: variants and map are both sorted by position, index_to only moves forward
+	int index_to = 0;
+	for (int s = 0 ; s < vec_bp.size() ; s ++) {
+		if (vec_cm[s] < 0) {
+			if (vec_bp[s] < pos_bp[0]) vec_cm[s] = pos_cM[0] - mean_rate * (pos_bp[0] - vec_bp[s]);
+			else if (vec_bp[s] > pos_bp.back()) vec_cm[s] = pos_cM.back() + mean_rate * (vec_bp[s] - pos_bp.back());
 			else {
-				int index_from, index_to;
-				for ( index_from = 0 ; index_from < pos_bp.size() && pos_bp[index_from] < vec_pos[s]->bp; ) index_from ++ ;
-				for ( index_to = pos_cM.size() - 1 ; index_to >= 0 && pos_bp[index_to] > vec_pos[s]->bp; ) index_to --;
-				index_from--;
-				index_to++;
-				vec_pos[s]->cm = pos_cM[index_from] + (vec_pos[s]->bp - pos_bp[index_from]) * (pos_cM[index_to] - pos_cM[index_from]) / (pos_bp[index_to] - pos_bp[index_from]);
-				}
+				while (pos_bp[index_to] <= vec_bp[s]) index_to ++;
+				int index_from = index_to - 1;
+				vec_cm[s] = pos_cM[index_from] + (vec_bp[s] - pos_bp[index_from]) * (pos_cM[index_to] - pos_cM[index_from]) / (pos_bp[index_to] - pos_bp[index_from]);
+			}
 			cpt++;
 		}
-		vrb.progress("  * cM interpolation", (s+1)*1.0/vec_pos.size());
-
+		vrb.progress("  * cM interpolation", (s+1)*1.0/vec_bp.size());
 	}
-	if (vec_pos[0]->cm < 0) {
-		double socle = -1.0 * vec_pos[0]->cm;
-		for (int s = 0 ; s < vec_pos.size() ; s ++) vec_pos[s]->cm += socle;
+	if (vec_cm[0] < 0) {
+		double socle = -1.0 * vec_cm[0];
+		for (int s = 0 ; s < vec_cm.size() ; s ++) vec_cm[s] += socle;
 	}
 	return cpt;
 }
 
 unsigned int variant_map::length() {
-	return vec_pos.back()->bp - vec_pos[0]->bp + 1;
+	return vec_bp.back() - vec_bp[0] + 1;
+}
+
+unsigned long variant_map::sizeOf() {
+	unsigned long size = vec_chr.capacity() * sizeof(unsigned short) + vec_bp.capacity() * sizeof(int) + vec_cm.capacity() * sizeof(double);
+	size += (vec_cref.capacity() + vec_calt.capacity() + vec_cmis.capacity()) * sizeof(unsigned int);
+	size += vec_str.capacity() * sizeof(unsigned long) + pool.capacity();
+	for (int c = 0 ; c < chrs.size() ; c ++) size += chrs[c].capacity();
+	return size;
 }
 
 void variant_map::setGeneticMap(gmap_reader & readerGM) {
@@ -23,14 +23,20 @@
 #define _SNP_SET_H
 
 #include <utils/otools.h>
-#include <objects/variant.h>
 #include <io/gmap_reader.h>
 
 class variant_map {
 public :
-	//DATA
-	vector < variant * > vec_pos;			//vector of variants ordered by position in bp
-	multimap < int, variant * > map_pos;	//associative container of variant with position in bp
+	//DATA (one entry per variant in each column, variants ordered by position in bp)
+	vector < string > chrs;					//interned chromosome names
+	vector < unsigned short > vec_chr;		//chromosome of each variant, index in chrs
+	vector < int > vec_bp;					//position in bp
+	vector < double > vec_cm;				//position in cM (-1 while unknown)
+	vector < unsigned int > vec_cref;		//REF allele count
+	vector < unsigned int > vec_calt;		//ALT allele count
+	vector < unsigned int > vec_cmis;		//missing genotype count
+	vector < unsigned long > vec_str;		//offset in pool of the null-terminated ID, followed by REF and ALT
+	vector < char > pool;					//string pool of IDs and alleles
 
 	//CONSTRUCTOR/DESTRUCTOR
 	variant_map();
@@ -38,14 +44,63 @@ public :
 
 	//METHODS
 	int size();
-	vector < variant * > getByPos(int);
-	vector < variant * > getByRef(int, string &, string &);
-	variant * getByIndex(int);
-	void push(variant *);
+	void push(const char * chr, int bp, const char * id, const char * ref, const char * alt, unsigned int cref, unsigned int calt, unsigned int cmis);
+	void shrink();
+	const string & chr(int);
+	const char * id(int);
+	const char * ref(int);
+	const char * alt(int);
+	unsigned int getMAC(int);
+	bool isSingleton(int);
+	bool isMonomorphic(int);
+	int lowerBound(int);					//Index of the first variant at or after a position in bp
 	void setGeneticMap(gmap_reader&);
 	int setCentiMorgan(vector < int > & pos_bp, vector < double > & pos_cM);
 	int interpolateCentiMorgan(vector < int > & pos_bp, vector < double > & pos_cM);
 	unsigned int length();
+	unsigned long sizeOf();					//Memory used by the table in bytes (used for verbose).
 };
 
+inline
+int variant_map::size() {
+	return vec_bp.size();
+}
+
+inline
+const string & variant_map::chr(int i) {
+	return chrs[vec_chr[i]];
+}
+
+inline
+const char * variant_map::id(int i) {
+	return &pool[vec_str[i]];
+}
+
+inline
+const char * variant_map::ref(int i) {
+	const char * s = id(i);
+	return s + strlen(s) + 1;
+}
+
+inline
+const char * variant_map::alt(int i) {
+	const char * s = ref(i);
+	return s + strlen(s) + 1;
+}
+
+inline
+unsigned int variant_map::getMAC(int i) {
+	return min(vec_cref[i], vec_calt[i]);
+}
+
+inline
+bool variant_map::isSingleton(int i) {
+	return (vec_calt[i] == 1 || vec_cref[i] == 1);
+}
+
+inline
+bool variant_map::isMonomorphic(int i) {
+	return (vec_calt[i] == 0 || vec_cref[i] == 0);
+}
+
 #endif
@@ -19,33 +19,33 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  ******************************************************************************/
-#ifndef _VARIANT_H
-#define _VARIANT_H
+#ifndef _CONVERTER_H
+#define _CONVERTER_H
 
 #include <utils/otools.h>
 
-class variant {
-public :
-	//DATA
-	string chr;
-	int bp;
-	string id;
-	string ref;
-	string alt;
-	double cm;
-	int idx;
-	unsigned int cref;
-	unsigned int calt;
-	unsigned int cmis;
-	unsigned int fbin;
+class converter {
+public:
+	//COMMAND LINE OPTIONS
+	bpo::options_description descriptions;
+	bpo::variables_map options;
 
-	//CONSTRUCTOR/DESTRUCTOR
-	variant(string & chr, int bp, string & id, string & ref, string & alt, int idx);
-	~variant();
+	//MULTI-THREADING
+	htsThreadPool hts_pool;
 
-	bool isSingleton();
-	bool isMonomorphic();
-	unsigned int getMAC();
+	//CONSTRUCTOR
+	converter();
+	~converter();
+
+	//PARAMETERS
+	void declare_options();
+	void parse_command_line(vector < string > &);
+	void check_options();
+	void verbose_files();
+	void verbose_options();
+
+	//
+	void convert(vector < string > &);
 };
 
 #endif
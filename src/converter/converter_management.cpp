@@ -19,34 +19,32 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
-#define _GLOBAL
-#include <objects/variant.h>
+#include <converter/converter_header.h>
 
-variant::variant(string & chr, int bp, string & id, string & ref, string & alt, int idx) {
-	this->chr = chr;
-	this->bp = bp;
-	this->id = id;
-	this->ref = ref;
-	this->alt = alt;
-	this->idx = idx;
-	this->cref = 0;
-	this->calt = 0;
-	this->cmis = 0;
-	this->fbin = 0;
-	cm = -1;
-}
+#include <io/reference_panel.h>
 
-variant::~variant() {
+converter::converter() {
+	hts_pool.pool = NULL;
+	hts_pool.qsize = 0;
 }
 
-unsigned int variant::getMAC() {
-	return min(cref, calt);
+converter::~converter() {
 }
 
-bool variant::isSingleton() {
-	return (calt == 1 || cref == 1);
-}
+void converter::convert(vector < string > & args) {
+	declare_options();
+	parse_command_line(args);
+	check_options();
+	verbose_files();
+	verbose_options();
+
+	vrb.title("Conversion:");
+	if (options["thread"].as < int > () > 1 && !(hts_pool.pool = hts_tpool_init(options["thread"].as < int > ())))
+		vrb.error("Impossible to create the htslib thread pool");
+	reference_panel panel;
+	panel.convert(options["input"].as < string > (), options["region"].as < string > (), options["output"].as < string > (), hts_pool.pool?(&hts_pool):NULL);
+	if (hts_pool.pool) hts_tpool_destroy(hts_pool.pool);
+	hts_pool.pool = NULL;
 
-bool variant::isMonomorphic() {
-	return (calt == 0 || cref == 0);
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
 }
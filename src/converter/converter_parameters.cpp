@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <converter/converter_header.h>
+
+void converter::declare_options() {
+	bpo::options_description opt_base ("Basic options");
+	opt_base.add_options()
+			("help", "Produce help message")
+			("thread,T", bpo::value<int>()->default_value(1), "Number of thread used for decompression");
+
+	bpo::options_description opt_input ("Input files");
+	opt_input.add_options()
+			("input,I", bpo::value< string >(), "Reference panel of haplotypes in VCF/BCF format")
+			("region,R", bpo::value< string >(), "Chromosome (or region of it) to convert");
+
+	bpo::options_description opt_output ("Output files");
+	opt_output.add_options()
+			("output,O", bpo::value< string >(), "Reference panel in binary format, to be given to --reference when phasing")
+			("log", bpo::value< string >(), "Log file");
+
+	descriptions.add(opt_base).add(opt_input).add(opt_output);
+}
+
+void converter::parse_command_line(vector < string > & args) {
+	try {
+		bpo::store(bpo::command_line_parser(args).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	if (options.count("log") && !vrb.open_log(options["log"].as < string > ()))
+		vrb.error("Impossible to create log file [" + options["log"].as < string > () +"]");
+
+	vrb.title("SHAPEIT [convert-reference]");
+	vrb.bullet("Author        : Olivier DELANEAU, University of Lausanne");
+	vrb.bullet("Contact       : olivier.delaneau@gmail.com");
+	vrb.bullet("Version       : 4.0.0");
+	vrb.bullet("Run date      : " + tac.date());
+}
+
+void converter::check_options() {
+	if (!options.count("input"))
+		vrb.error("You must specify one input file using --input");
+
+	if (!options.count("region"))
+		vrb.error("You must specify the chromosome to convert using --region");
+
+	if (!options.count("output"))
+		vrb.error("You must specify a binary output file with --output");
+
+	if (options.count("thread") && options["thread"].as < int > () < 1)
+		vrb.error("You must use at least 1 thread");
+}
+
+void converter::verbose_files() {
+	vrb.title("Files:");
+	vrb.bullet("Reference VCF : [" + options["input"].as < string > () + "]");
+	vrb.bullet("Output panel  : [" + options["output"].as < string > () + "]");
+	if (options.count("log")) vrb.bullet("Output LOG    : [" + options["log"].as < string > () + "]");
+}
+
+void converter::verbose_options() {
+	vrb.title("Parameters:");
+	vrb.bullet("Region  : " + options["region"].as < string > ());
+	vrb.bullet("Threads : " + stb.str(options["thread"].as < int > ()) + " threads");
+}
@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/genotype_cache.h>
+
+static const char cache_magic [8] = { 'S', 'H', 'P', '4', 'C', 'H', 'E', 1 };
+
+template < typename T >
+static void writeScalar(std::ofstream & fd, T value) {
+	fd.write(reinterpret_cast < const char * > (&value), sizeof(T));
+}
+
+template < typename T >
+static void writeArray(std::ofstream & fd, const T * data, unsigned long n) {
+	writeScalar < unsigned long > (fd, n);
+	if (n) fd.write(reinterpret_cast < const char * > (data), n * sizeof(T));
+}
+
+template < typename T >
+static T readScalar(std::ifstream & fd) {
+	T value = T();
+	fd.read(reinterpret_cast < char * > (&value), sizeof(T));
+	return value;
+}
+
+template < typename T >
+static void readVector(std::ifstream & fd, vector < T > & data) {
+	unsigned long n = readScalar < unsigned long > (fd);
+	if (!fd) return;
+	data.resize(n);
+	if (n) fd.read(reinterpret_cast < char * > (data.data()), n * sizeof(T));
+}
+
+static void writeBitmatrix(std::ofstream & fd, bitmatrix & BM) {
+	writeScalar < unsigned long > (fd, BM.n_rows);
+	writeScalar < unsigned long > (fd, BM.n_cols);
+	fd.write(reinterpret_cast < const char * > (BM.bytes), BM.n_bytes);
+}
+
+static void readBitmatrix(std::ifstream & fd, bitmatrix & BM) {
+	unsigned long n_rows = readScalar < unsigned long > (fd);
+	unsigned long n_cols = readScalar < unsigned long > (fd);
+	if (!fd) return;
+	if (BM.bytes) free(BM.bytes);
+	BM.allocate(n_rows, n_cols);
+	fd.read(reinterpret_cast < char * > (BM.bytes), BM.n_bytes);
+}
+
+genotype_cache::genotype_cache(haplotype_set & _H, genotype_set & _G, variant_map & _V) : H(_H), G(_G), V(_V) {
+}
+
+genotype_cache::~genotype_cache() {
+}
+
+/*
+ * FNV-1a over the settings and over the contents of the files, read 8 bytes at a time.
+ */
+unsigned long genotype_cache::checksum(vector < string > & files, string settings) {
+	tac.clock();
+	unsigned long key = 14695981039346656037UL;
+	for (int c = 0 ; c < settings.size() ; c ++) key = (key ^ (unsigned char)settings[c]) * 1099511628211UL;
+	vector < unsigned long > buffer = vector < unsigned long > (1UL << 17);
+	for (int f = 0 ; f < files.size() ; f ++) {
+		std::ifstream fd (files[f].c_str(), std::ios::in | std::ios::binary);
+		if (!fd.is_open()) vrb.error("Cannot open file [" + files[f] + "] for reading");
+		unsigned long n_bytes = 0;
+		while (fd.read(reinterpret_cast < char * > (buffer.data()), buffer.size() * sizeof(unsigned long)) || fd.gcount()) {
+			unsigned long n_read = fd.gcount(), n_words = n_read / sizeof(unsigned long);
+			if (n_read % sizeof(unsigned long)) memset(reinterpret_cast < char * > (buffer.data()) + n_read, 0, sizeof(unsigned long) - n_read % sizeof(unsigned long));
+			n_words += (n_read % sizeof(unsigned long) != 0);
+			for (unsigned long w = 0 ; w < n_words ; w ++) key = (key ^ buffer[w]) * 1099511628211UL;
+			n_bytes += n_read;
+		}
+		key = (key ^ n_bytes) * 1099511628211UL;
+	}
+	vrb.bullet("Cache key [" + stb.str(key) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	return key;
+}
+
+bool genotype_cache::load(string fname, unsigned long key) {
+	tac.clock();
+	std::ifstream fd (fname.c_str(), std::ios::in | std::ios::binary);
+	if (!fd.is_open()) return false;
+	char magic [8];
+	if (!fd.read(magic, 8) || memcmp(magic, cache_magic, 8) || readScalar < unsigned long > (fd) != key) {
+		vrb.bullet("Cache [" + fname + "] does not match the input files or settings");
+		return false;
+	}
+
+	//1. Variant table
+	unsigned long n_chrs = readScalar < unsigned long > (fd);
+	V.chrs = vector < string > (n_chrs);
+	for (unsigned long c = 0 ; c < n_chrs && fd ; c ++) std::getline(fd, V.chrs[c], '\0');
+	readVector(fd, V.vec_chr);
+	readVector(fd, V.vec_bp);
+	readVector(fd, V.vec_cm);
+	readVector(fd, V.vec_cref);
+	readVector(fd, V.vec_calt);
+	readVector(fd, V.vec_cmis);
+	readVector(fd, V.vec_str);
+	readVector(fd, V.pool);
+
+	//2. Genotype graphs
+	G.n_ind = readScalar < int > (fd);
+	G.n_site = readScalar < int > (fd);
+	G.sparse = readScalar < bool > (fd);
+	G.vstride = readScalar < unsigned long > (fd);
+	if (!fd) vrb.error("Truncated cache [" + fname + "]");
+	G.storeG.clear();
+	G.storeG.reserve(G.n_ind);
+	G.vecG = vector < genotype * > (G.n_ind);
+	for (unsigned int i = 0 ; i < G.n_ind ; i ++) {
+		G.storeG.emplace_back(i);
+		genotype * g = G.vecG[i] = &G.storeG[i];
+		g->n_segments = readScalar < unsigned int > (fd);
+		g->n_variants = readScalar < unsigned int > (fd);
+		g->n_ambiguous = readScalar < unsigned int > (fd);
+		g->n_transitions = readScalar < unsigned int > (fd);
+		g->n_sparse = readScalar < unsigned int > (fd);
+		vector < unsigned int > ps;
+		readVector(fd, ps);
+		const phase_set * ps_begin = reinterpret_cast < const phase_set * > (ps.data());
+		g->PhaseSets.assign(ps_begin, ps_begin + ps.size());
+	}
+	if (!G.sparse) {
+		G.arenaVariants = (unsigned char *)realloc(G.arenaVariants, max(G.n_ind * G.vstride, 1UL));
+		fd.read(reinterpret_cast < char * > (G.arenaVariants), G.n_ind * G.vstride);
+	}
+	readVector(fd, G.arenaSparse);
+	readVector(fd, G.arenaAmbiguous);
+	readVector(fd, G.arenaDiplotypes);
+	readVector(fd, G.arenaLengths);
+	readVector(fd, G.arenaNames);
+	for (unsigned long i = 0, noffset = 0, eoffset = 0, aoffset = 0, soffset = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		g->name = &G.arenaNames[noffset];
+		if (G.sparse) g->Sparse = G.arenaSparse.data() + eoffset;
+		else g->Variants = G.arenaVariants + i * G.vstride;
+		g->Ambiguous = G.arenaAmbiguous.data() + aoffset;
+		g->Diplotypes = G.arenaDiplotypes.data() + soffset;
+		g->Lengths = G.arenaLengths.data() + soffset;
+		noffset += strlen(g->name) + 1;
+		eoffset += g->n_sparse;
+		aoffset += g->n_ambiguous;
+		soffset += g->n_segments;
+	}
+
+	//3. Haplotypes and IBD2 masks
+	H.n_site = readScalar < unsigned long > (fd);
+	H.n_hap = readScalar < unsigned long > (fd);
+	H.n_ind = readScalar < unsigned long > (fd);
+	readBitmatrix(fd, H.H_opt_hap);
+	readBitmatrix(fd, H.H_opt_var);
+	H.lengthIBD2 = readScalar < unsigned long > (fd);
+	unsigned long n_blocks = readScalar < unsigned long > (fd);
+	H.flagIBD2 = vector < vector < bool > > (n_blocks, vector < bool > (H.n_ind, false));
+	H.idxIBD2 = vector < vector < pair < int, int > > > (n_blocks);
+	vector < unsigned char > flags;
+	for (unsigned long b = 0 ; b < n_blocks && fd ; b ++) {
+		readVector(fd, flags);
+		for (unsigned long i = 0 ; i < flags.size() && i < H.n_ind ; i ++) H.flagIBD2[b][i] = flags[i];
+		readVector(fd, H.idxIBD2[b]);
+	}
+	if (!fd) vrb.error("Truncated cache [" + fname + "]");
+	vrb.bullet("Cache loaded [N=" + stb.str(G.n_ind) + " / L=" + stb.str(V.size()) + " / Seg=" + stb.str(G.numberOfSegments()) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	return true;
+}
+
+void genotype_cache::save(string fname, unsigned long key) {
+	tac.clock();
+	std::ofstream fd (fname.c_str(), std::ios::out | std::ios::binary);
+	if (!fd.is_open()) vrb.error("Impossible to create [" + fname + "]");
+	fd.write(cache_magic, 8);
+	writeScalar < unsigned long > (fd, key);
+
+	//1. Variant table
+	writeScalar < unsigned long > (fd, V.chrs.size());
+	for (unsigned long c = 0 ; c < V.chrs.size() ; c ++) fd.write(V.chrs[c].c_str(), V.chrs[c].size() + 1);
+	writeArray(fd, V.vec_chr.data(), V.vec_chr.size());
+	writeArray(fd, V.vec_bp.data(), V.vec_bp.size());
+	writeArray(fd, V.vec_cm.data(), V.vec_cm.size());
+	writeArray(fd, V.vec_cref.data(), V.vec_cref.size());
+	writeArray(fd, V.vec_calt.data(), V.vec_calt.size());
+	writeArray(fd, V.vec_cmis.data(), V.vec_cmis.size());
+	writeArray(fd, V.vec_str.data(), V.vec_str.size());
+	writeArray(fd, V.pool.data(), V.pool.size());
+
+	//2. Genotype graphs
+	writeScalar < int > (fd, G.n_ind);
+	writeScalar < int > (fd, G.n_site);
+	writeScalar < bool > (fd, G.sparse);
+	writeScalar < unsigned long > (fd, G.vstride);
+	for (unsigned int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		writeScalar < unsigned int > (fd, g->n_segments);
+		writeScalar < unsigned int > (fd, g->n_variants);
+		writeScalar < unsigned int > (fd, g->n_ambiguous);
+		writeScalar < unsigned int > (fd, g->n_transitions);
+		writeScalar < unsigned int > (fd, g->n_sparse);
+		writeArray(fd, g->PhaseSets.data(), g->PhaseSets.size());
+	}
+	if (!G.sparse) fd.write(reinterpret_cast < const char * > (G.arenaVariants), G.n_ind * G.vstride);
+	writeArray(fd, G.arenaSparse.data(), G.arenaSparse.size());
+	writeArray(fd, G.arenaAmbiguous.data(), G.arenaAmbiguous.size());
+	writeArray(fd, G.arenaDiplotypes.data(), G.arenaDiplotypes.size());
+	writeArray(fd, G.arenaLengths.data(), G.arenaLengths.size());
+	writeArray(fd, G.arenaNames.data(), G.arenaNames.size());
+
+	//3. Haplotypes and IBD2 masks
+	writeScalar < unsigned long > (fd, H.n_site);
+	writeScalar < unsigned long > (fd, H.n_hap);
+	writeScalar < unsigned long > (fd, H.n_ind);
+	writeBitmatrix(fd, H.H_opt_hap);
+	writeBitmatrix(fd, H.H_opt_var);
+	writeScalar < unsigned long > (fd, H.lengthIBD2);
+	writeScalar < unsigned long > (fd, H.flagIBD2.size());
+	vector < unsigned char > flags;
+	for (unsigned long b = 0 ; b < H.flagIBD2.size() ; b ++) {
+		flags.assign(H.flagIBD2[b].begin(), H.flagIBD2[b].end());
+		writeArray(fd, flags.data(), flags.size());
+		writeArray(fd, H.idxIBD2[b].data(), H.idxIBD2[b].size());
+	}
+	fd.close();
+	if (fd.fail()) vrb.error("Non zero status when closing [" + fname + "]");
+	vrb.bullet("Cache written [" + fname + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _GENOTYPE_CACHE_H
+#define _GENOTYPE_CACHE_H
+
+#include <utils/otools.h>
+
+#include <containers/variant_map.h>
+#include <containers/genotype_set.h>
+#include <containers/haplotype_set.h>
+
+/*
+ * Binary dump of the data as initialised by phaser::read_files_and_initialise (variant table with cM positions,
+ * genotype graphs and their arenas, haplotype matrices after PBWT initialisation and IBD2 masks), so that runs on the
+ * same data with other MCMC, PBWT or window settings skip reading and initialisation. The file starts with a key,
+ * checksum of the contents of the input files and of the settings the initialised data depends on; a cache with
+ * another key is ignored (and overwritten).
+ */
+class genotype_cache {
+public:
+	//DATA
+	haplotype_set & H;
+	genotype_set & G;
+	variant_map & V;
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	genotype_cache(haplotype_set &, genotype_set &, variant_map &);
+	~genotype_cache();
+
+	//IO
+	static unsigned long checksum(vector < string > & files, string settings);
+	bool load(string, unsigned long);
+	void save(string, unsigned long);
+};
+
+#endif
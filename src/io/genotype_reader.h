@@ -27,6 +27,10 @@
 #include <containers/variant_map.h>
 #include <containers/haplotype_set.h>
 
+#include <io/reference_panel.h>
+
+#define READER_CHUNK	(1UL<<16)	//Initial variant capacity when the index cannot tell how many records to expect
+
 class genotype_reader {
 public:
 	//DATA
@@ -34,9 +38,11 @@ public:
 	genotype_set & G;
 	variant_map & V;
 	string region;
+	htsThreadPool * pool;
 	//COUNTS
 	bool use_PS_field;
 	unsigned long n_variants;
+	unsigned long n_capacity;
 	unsigned long n_main_samples;
 	unsigned long n_ref_samples;
 	unsigned long n_geno_tot;
@@ -45,22 +51,52 @@ public:
 	unsigned long n_geno_ips;
 	unsigned long n_geno_sca;
 	unsigned long n_geno_mis;
+	unsigned long n_ref_missing;
+	unsigned long n_ref_unphased;
+	//FILTERING
+	unsigned int min_mac;				//Variants with a lower minor allele count in the main samples are skipped (0: none)
+	unsigned long n_rare;
+	//TIMINGS
+	double t_read;		//Time spent waiting for records from htslib (decompression and decoding), in ms
+	//DECODING BUFFERS
+	int * gt_arr_main, ngt_arr_main;
+	bcf1_t * gt_line_main;				//Record whose genotypes are already decoded in gt_arr_main by isRare (NULL: none)
+	int * gt_arr_ref, ngt_arr_ref;
+	int * gt_arr_scaf, ngt_arr_scaf;
+	int * ps_arr_main, nps_arr_main;
+	vector < unsigned char > codes;		//Codes of the main samples at the variant being decoded
+	vector < int > mappingS2G;			//Main sample index of each scaffold sample (-1 if absent)
 	//PHASESETS
 	unordered_map < int, int > PSmap;
 	vector < int > PScodes;
 
 	//CONSTRUCTORS/DESCTRUCTORS
-	genotype_reader(haplotype_set &, genotype_set &, variant_map &, string regions, bool use_PS_field);
+	genotype_reader(haplotype_set &, genotype_set &, variant_map &, string regions, bool use_PS_field, htsThreadPool * pool = NULL);
 	~genotype_reader();
 
 	//IO
-	void scanGenotypes(string funphased);
-	void scanGenotypes(string funphased, string fphased);
-	void allocateGenotypes();
+	unsigned long estimateVariants(bcf_srs_t *);
+	void allocateGenotypes(bcf_srs_t *, unsigned long);
+	void growGenotypes();
+	void finaliseGenotypes(unsigned long);
+	bcf_srs_t * openReaders();
+	int nextLine(bcf_srs_t *);
+	string timings();
+	bool isRare(bcf_hdr_t *, bcf1_t *);
+	void decodeMain(bcf_hdr_t *, bcf1_t *, unsigned int, unsigned int &, unsigned int &, unsigned int &);
+	void decodeReference(bcf_hdr_t *, bcf1_t *, unsigned int, unsigned int &, unsigned int &);
+	void decodePanel(reference_panel &, unsigned long, unsigned int, unsigned int &, unsigned int &);
+	void decodeScaffold(bcf_hdr_t *, bcf1_t *, unsigned int);
+	void mapScaffold(bcf_hdr_t *);
+	void releaseBuffers();
+	void reportGenotypes(bool, bool);
 	void readGenotypes0(string);
 	void readGenotypes1(string, string);
 	void readGenotypes2(string, string);
 	void readGenotypes3(string, string, string);
+	void readGenotypes4(string, string);
+	void readGenotypes5(string, string, string);
+	void scanPositions(string, vector < int > &);
 	void setPScodes(int * ps_arr, int nps);
 };
 
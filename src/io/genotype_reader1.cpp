@@ -21,8 +21,13 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <io/genotype_reader.h>
 
-genotype_reader::genotype_reader(haplotype_set & _H, genotype_set & _G, variant_map & _V, string _region, bool _use_PS_field) : H(_H), G(_G), V(_V) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+genotype_reader::genotype_reader(haplotype_set & _H, genotype_set & _G, variant_map & _V, string _region, bool _use_PS_field, htsThreadPool * _pool) : H(_H), G(_G), V(_V) {
 	n_variants = 0;
+	n_capacity = 0;
 	n_main_samples = 0;
 	n_ref_samples = 0;
 	region = _region;
@@ -32,6 +37,15 @@ genotype_reader::genotype_reader(haplotype_set & _H, genotype_set & _G, variant_
 	n_geno_sca = 0;
 	n_geno_mis = 0;
 	use_PS_field = _use_PS_field;
+	pool = _pool;
+	t_read = 0.0;
+	n_ref_missing = 0;
+	n_ref_unphased = 0;
+	min_mac = 0;
+	n_rare = 0;
+	gt_arr_main = gt_arr_ref = gt_arr_scaf = ps_arr_main = NULL;
+	ngt_arr_main = ngt_arr_ref = ngt_arr_scaf = nps_arr_main = 0;
+	gt_line_main = NULL;
 }
 
 genotype_reader::~genotype_reader() {
@@ -39,25 +53,268 @@ genotype_reader::~genotype_reader() {
 	n_main_samples = 0;
 	n_ref_samples = 0;
 	region = "";
+	releaseBuffers();
+}
+
+unsigned long genotype_reader::estimateVariants(bcf_srs_t * sr) {
+	//Record count of the region contig stored in the index of the main file; only usable as a capacity when the whole contig is read
+	if (region.find_first_of(":,") != string::npos) return 0;
+	uint64_t n_mapped = 0, n_unmapped = 0;
+	int ret = -1;
+	if (sr->readers[0].tbx_idx) ret = hts_idx_get_stat(sr->readers[0].tbx_idx->idx, tbx_name2id(sr->readers[0].tbx_idx, region.c_str()), &n_mapped, &n_unmapped);
+	else if (sr->readers[0].bcf_idx) ret = hts_idx_get_stat(sr->readers[0].bcf_idx, bcf_hdr_name2id(sr->readers[0].header, region.c_str()), &n_mapped, &n_unmapped);
+	return (ret < 0)?0:n_mapped;
 }
 
-void genotype_reader::allocateGenotypes() {
-	assert(n_variants != 0 && (n_main_samples+n_ref_samples) != 0);
+void genotype_reader::allocateGenotypes(bcf_srs_t * sr, unsigned long _n_ref_samples) {
+	n_main_samples = bcf_hdr_nsamples(sr->readers[0].header);
+	n_ref_samples = _n_ref_samples;
+	n_variants = 0;
+	n_capacity = estimateVariants(sr);
+	if (n_capacity == 0) n_capacity = READER_CHUNK;
+	if (G.sparse) n_capacity = min(n_capacity, (unsigned long)SPA_MAX_SITE);
+	assert((n_main_samples+n_ref_samples) != 0);
 	//Genotypes
-	G.vecG = vector < genotype * > (n_main_samples);
-	for (unsigned int i = 0 ; i < n_main_samples ; i ++) {
-		G.vecG[i] = new genotype (i);
-		G.vecG[i]->n_variants = n_variants;
-		G.vecG[i]->Variants = vector < unsigned char > (DIV2(n_variants) + MOD2(n_variants), 0);
-	}
-	G.n_ind = n_main_samples;
-	G.n_site = n_variants;
+	G.allocate(n_main_samples, n_capacity);
+	G.allocateNames(sr->readers[0].header->samples);
 	//Haplotypes
 	H.n_ind = n_main_samples;
 	H.n_hap = 2 * (n_main_samples + n_ref_samples);
+	H.H_opt_var.allocate(n_capacity, H.n_hap);
+}
+
+void genotype_reader::growGenotypes() {
+	if (G.sparse && n_capacity >= SPA_MAX_SITE) vrb.error("Too many variants for sparse genotype storage [" + stb.str(n_capacity) + "]");
+	n_capacity *= 2;
+	if (G.sparse) n_capacity = min(n_capacity, (unsigned long)SPA_MAX_SITE);
+	G.reserve(n_capacity);
+	H.H_opt_var.resizeRows(n_capacity);
+}
+
+void genotype_reader::finaliseGenotypes(unsigned long _n_variants) {
+	n_variants = _n_variants;
+	if (n_variants == 0) vrb.error("No variants to be phased in region [" + region + "]");
+	G.finalise(n_variants);
+	V.shrink();
 	H.n_site = n_variants;
-	H.H_opt_var.allocate(H.n_site, H.n_hap);
+	H.H_opt_var.resizeRows(n_variants);
 	H.H_opt_hap.allocate(H.n_hap, H.n_site);
+	n_capacity = n_variants;
+	if (n_ref_samples) vrb.bullet("VCF/BCF content [Nm=" + stb.str(n_main_samples) + " / Nr=" + stb.str(n_ref_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "]");
+	else vrb.bullet("VCF/BCF content [N=" + stb.str(n_main_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "]");
+}
+
+bcf_srs_t * genotype_reader::openReaders() {
+	bcf_srs_t * sr =  bcf_sr_init();
+	//Readers added afterwards share the pool; it stays owned by the caller since sr->n_threads is left to 0
+	if (pool) sr->p = pool;
+	t_read = 0.0;
+	return sr;
+}
+
+int genotype_reader::nextLine(bcf_srs_t * sr) {
+	std::chrono::time_point<std::chrono::high_resolution_clock> t0 = std::chrono::high_resolution_clock::now();
+	int nset = bcf_sr_next_line(sr);
+	t_read += std::chrono::duration < double, std::milli > (std::chrono::high_resolution_clock::now() - t0).count();
+	return nset;
+}
+
+string genotype_reader::timings() {
+	double t_total = tac.rel_time();
+	return "Read=" + stb.str(t_read*0.001, 2) + "s / Parse=" + stb.str(max(0.0, t_total-t_read)*0.001, 2) + "s";
+}
+
+void genotype_reader::releaseBuffers() {
+	if (gt_arr_main) free(gt_arr_main);
+	if (gt_arr_ref) free(gt_arr_ref);
+	if (gt_arr_scaf) free(gt_arr_scaf);
+	if (ps_arr_main) free(ps_arr_main);
+	gt_arr_main = gt_arr_ref = gt_arr_scaf = ps_arr_main = NULL;
+	ngt_arr_main = ngt_arr_ref = ngt_arr_scaf = nps_arr_main = 0;
+	gt_line_main = NULL;
+	vector < unsigned char > ().swap(codes);
+}
+
+/*
+ * Converts the interleaved GT pairs of n samples into VAR_* codes with e=0 (hap0, hap1 and missing or het type).
+ * An allele is ALT when its GT value is bcf_gt_unphased(1) or bcf_gt_phased(1), and a sample is missing when
+ * one of its GT values is bcf_gt_missing; this is computed on 4 samples at a time with SSE2 when available.
+ */
+static void decodeCodes(const int * gt, unsigned int n, unsigned char * codes) {
+	unsigned int i = 0;
+#ifdef __SSE2__
+	const __m128i m_clr = _mm_set1_epi32(~1), m_zero = _mm_setzero_si128();
+	const __m128i m_1 = _mm_set1_epi32(1), m_2 = _mm_set1_epi32(2), m_4 = _mm_set1_epi32(4), m_8 = _mm_set1_epi32(8);
+	for (; i + 4 <= n ; i += 4) {
+		__m128 lo = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(gt + 2 * i)));
+		__m128 hi = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(gt + 2 * i + 4)));
+		__m128i g0 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i g1 = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128i a0 = _mm_cmpeq_epi32(_mm_and_si128(g0, m_clr), m_4);
+		__m128i a1 = _mm_cmpeq_epi32(_mm_and_si128(g1, m_clr), m_4);
+		__m128i mi = _mm_or_si128(_mm_cmpeq_epi32(g0, m_zero), _mm_cmpeq_epi32(g1, m_zero));
+		__m128i he = _mm_andnot_si128(mi, _mm_xor_si128(a0, a1));
+		__m128i code = _mm_or_si128(_mm_or_si128(_mm_and_si128(a0, m_4), _mm_and_si128(a1, m_8)), _mm_or_si128(_mm_and_si128(mi, m_1), _mm_and_si128(he, m_2)));
+		code = _mm_packs_epi32(code, code);
+		code = _mm_packus_epi16(code, code);
+		int packed = _mm_cvtsi128_si32(code);
+		memcpy(codes + i, &packed, 4);
+	}
+#endif
+	for (; i < n ; i ++) {
+		bool a0 = (bcf_gt_allele(gt[2*i+0])==1);
+		bool a1 = (bcf_gt_allele(gt[2*i+1])==1);
+		bool mi = (gt[2*i+0] == bcf_gt_missing || gt[2*i+1] == bcf_gt_missing);
+		unsigned char code = 0;
+		if (a0) VAR_SET_HAP0(0, code);
+		if (a1) VAR_SET_HAP1(0, code);
+		if (mi) VAR_SET_MIS(0, code);
+		else if (a0 != a1) VAR_SET_HET(0, code);
+		codes[i] = code;
+	}
+}
+
+bool genotype_reader::isRare(bcf_hdr_t * hdr, bcf1_t * line) {
+	//Minor allele count over the main samples only, so that a variant is set aside the same way with or without reference panel
+	if (!min_mac) return false;
+	int ngt_main = bcf_get_genotypes(hdr, line, &gt_arr_main, &ngt_arr_main);
+	unsigned int cref = 0, calt = 0;
+	for (int i = 0 ; i < ngt_main ; i ++) {
+		if (gt_arr_main[i] == bcf_gt_missing || gt_arr_main[i] == bcf_int32_vector_end) continue;
+		if (bcf_gt_allele(gt_arr_main[i]) == 1) calt ++;
+		else cref ++;
+	}
+	bool rare = (min(cref, calt) < min_mac);
+	n_rare += rare;
+	//Genotypes of a kept variant are reused as is by decodeMain
+	gt_line_main = (rare || ngt_main != 2 * n_main_samples)?NULL:line;
+	return rare;
+}
+
+void genotype_reader::decodeMain(bcf_hdr_t * hdr, bcf1_t * line, unsigned int i_variant, unsigned int & cref, unsigned int & calt, unsigned int & cmis) {
+	if (gt_line_main != line) {
+		int ngt_main = bcf_get_genotypes(hdr, line, &gt_arr_main, &ngt_arr_main);
+		assert(ngt_main == 2 * n_main_samples);
+	}
+	gt_line_main = NULL;
+	codes.resize(n_main_samples);
+	decodeCodes(gt_arr_main, n_main_samples, codes.data());
+	G.setCodes(i_variant, codes.data());
+
+	//Allele and genotype counts from the histogram of the 16 possible codes
+	unsigned int hist [16] = { 0 };
+	for (unsigned int i = 0 ; i < n_main_samples ; i ++) hist[codes[i]] ++;
+	for (unsigned int c = 0 ; c < 16 ; c ++) {
+		if (!hist[c]) continue;
+		if (VAR_GET_MIS(0, c)) { cmis += hist[c]; n_geno_mis += hist[c]; continue; }
+		unsigned int n_alt = VAR_GET_HAP0(0, c) + VAR_GET_HAP1(0, c);
+		calt += n_alt * hist[c];
+		cref += (2 - n_alt) * hist[c];
+		if (VAR_GET_HET(0, c)) n_geno_het += hist[c];
+		else n_geno_hom += hist[c];
+	}
+
+	//Phase sets only concern missing and het genotypes
+	if (use_PS_field) {
+		int nps_main = bcf_get_format_int32(hdr, line, "PS", &ps_arr_main, &nps_arr_main);
+		setPScodes(ps_arr_main, nps_main);
+		for (unsigned int i = 0 ; i < n_main_samples ; i ++) if (VAR_GET_AMB(0, codes[i])) {
+			bool ph = (bcf_gt_is_phased(gt_arr_main[2*i+0]) || bcf_gt_is_phased(gt_arr_main[2*i+1])) && VAR_GET_HET(0, codes[i]) && PScodes.size() > 0;
+			G.vecG[i]->pushPS(VAR_GET_HAP0(0, codes[i]), VAR_GET_HAP1(0, codes[i]), ph?PScodes[i]:0);
+			n_geno_ips += ph;
+		}
+	}
+}
+
+void genotype_reader::decodeReference(bcf_hdr_t * hdr, bcf1_t * line, unsigned int i_variant, unsigned int & cref, unsigned int & calt) {
+	int ngt_ref = bcf_get_genotypes(hdr, line, &gt_arr_ref, &ngt_arr_ref);
+	assert(ngt_ref == 2 * n_ref_samples);
+	//Reference haplotypes are packed straight into the row of the variant in H_opt_var, one byte at a time
+	unsigned char * row = H.H_opt_var.bytes + ((unsigned long)i_variant) * (H.H_opt_var.n_cols/8);
+	unsigned int col = 2 * n_main_samples, n_alt = 0;
+	unsigned char acc = row[col/8];
+	for(int i = 0 ; i < 2 * n_ref_samples ; i ++, col ++) {
+		unsigned char a = (bcf_gt_allele(gt_arr_ref[i])==1);
+		acc |= a << (7 - (col%8));
+		n_alt += a;
+		if (col%8 == 7) { row[col/8] = acc; acc = 0; }
+		if (i%2) {
+			n_ref_missing += (gt_arr_ref[i-1] == bcf_gt_missing || gt_arr_ref[i] == bcf_gt_missing);
+			n_ref_unphased += !bcf_gt_is_phased(gt_arr_ref[i]);
+		}
+	}
+	if (col%8) row[col/8] = acc;
+	calt += n_alt;
+	cref += 2 * n_ref_samples - n_alt;
+}
+
+void genotype_reader::decodePanel(reference_panel & panel, unsigned long l, unsigned int i_variant, unsigned int & cref, unsigned int & calt) {
+	//Panel rows share the H_opt_var layout, so they are copied as bytes, shifted when the main haplotypes do not end on a byte boundary
+	const unsigned char * src = panel.row(l);
+	unsigned char * row = H.H_opt_var.bytes + ((unsigned long)i_variant) * (H.H_opt_var.n_cols/8);
+	unsigned long col = 2 * n_main_samples, shift = col % 8, n_dst = H.H_opt_var.n_cols/8;
+	unsigned char * dst = row + col/8;
+	unsigned int n_alt = 0;
+	if (shift == 0) memcpy(dst, src, panel.row_bytes);
+	for (unsigned long b = 0 ; b < panel.row_bytes ; b ++) {
+		if (shift) {
+			dst[b] |= src[b] >> shift;
+			if (col/8 + b + 1 < n_dst) dst[b+1] |= (unsigned char)(src[b] << (8 - shift));
+		}
+		n_alt += __builtin_popcount(src[b]);
+	}
+	calt += n_alt;
+	cref += 2 * n_ref_samples - n_alt;
+}
+
+void genotype_reader::mapScaffold(bcf_hdr_t * hdr) {
+	map < string, int > map_names;
+	for (int i = 0 ; i < n_main_samples ; i ++) map_names.insert(pair < string, int > (G.vecG[i]->name, i));
+	int n_scaf_samples = bcf_hdr_nsamples(hdr);
+	mappingS2G = vector < int > (n_scaf_samples, -1);
+	for (int i = 0 ; i < n_scaf_samples ; i ++) {
+		map < string, int > :: iterator it = map_names.find(string(hdr->samples[i]));
+		if (it != map_names.end()) mappingS2G[i] = it->second;
+	}
+}
+
+void genotype_reader::decodeScaffold(bcf_hdr_t * hdr, bcf1_t * line, unsigned int i_variant) {
+	int ngt_scaf = bcf_get_genotypes(hdr, line, &gt_arr_scaf, &ngt_arr_scaf);
+	assert(ngt_scaf == 2 * mappingS2G.size());
+	for(int i = 0 ; i < ngt_scaf ; i += 2) {
+		int ind = mappingS2G[DIV2(i)];
+		if (ind>=0) {
+			bool s0 = (bcf_gt_allele(gt_arr_scaf[i+0])==1);
+			bool s1 = (bcf_gt_allele(gt_arr_scaf[i+1])==1);
+			bool he = (s0 != s1);
+			bool ph = (bcf_gt_is_phased(gt_arr_scaf[i+0]) || bcf_gt_is_phased(gt_arr_scaf[i+1]));
+			bool mi = (gt_arr_scaf[i+0] == bcf_gt_missing || gt_arr_scaf[i+1] == bcf_gt_missing);
+			if (he && !mi && ph) {
+				unsigned char code = G.getCode(ind, i_variant);
+				bool a0 = VAR_GET_HAP0(0, code);
+				bool a1 = VAR_GET_HAP1(0, code);
+				if (a0!=a1) {
+					VAR_SET_SCA(0, code);
+					s0?VAR_SET_HAP0(0, code):VAR_CLR_HAP0(0, code);
+					s1?VAR_SET_HAP1(0, code):VAR_CLR_HAP1(0, code);
+					G.setCode(ind, i_variant, code);
+					n_geno_sca ++;
+				}
+			}
+		}
+	}
+}
+
+void genotype_reader::reportGenotypes(bool scaffold, bool reference) {
+	n_geno_tot = n_main_samples*n_variants;
+	string str_hom = "Hom=" + stb.str(n_geno_hom*100.0/n_geno_tot, 1) + "%";
+	string str_het = "Het=" + stb.str(n_geno_het*100.0/n_geno_tot, 1) + "%" + (use_PS_field?(" / Pha=" + stb.str(n_geno_ips*100.0/n_geno_tot, 3) + "%"):(""));
+	string str_sca = scaffold?("Sca=" + stb.str(n_geno_sca*100.0/n_geno_tot, 3) + "% / "):"";
+	string str_mis = "Mis=" + stb.str(n_geno_mis*100.0/n_geno_tot, 1) + "%";
+	vrb.bullet("VCF/BCF parsing ["+str_hom+" / "+str_het+" / "+str_sca+str_mis+"] ("+timings()+")");
+	if (min_mac) vrb.bullet("VCF/BCF filtering [MAC<" + stb.str(min_mac) + " / L=" + stb.str(n_rare) + " variants left out]");
+	if (reference && n_ref_missing > 0) vrb.warning(stb.str(n_ref_missing) + " missing genotypes in the reference panel (randomly imputed)");
+	if (reference && n_ref_unphased > 0) vrb.warning(stb.str(n_ref_unphased) + " unphased genotypes in the reference panel (randomly phased)");
 }
 
 void genotype_reader::setPScodes(int * ps_arr, int nps) {
@@ -78,47 +335,3 @@ void genotype_reader::setPScodes(int * ps_arr, int nps) {
 		}
 	}
 }
-
-void genotype_reader::scanGenotypes(string fmain) {
-	vrb.wait("  * VCF/BCF scanning");
-	tac.clock();
-	bcf_srs_t * sr =  bcf_sr_init();
-	if (bcf_sr_set_regions(sr, region.c_str(), 0) == -1) vrb.error("Impossible to jump to region [" + region + "] in [" + fmain + "]");
-	if(!(bcf_sr_add_reader (sr, fmain.c_str()))) vrb.error("Problem opening index file for [" + fmain + "]");
-	n_variants = 0;
-	n_main_samples = bcf_hdr_nsamples(sr->readers[0].header);
-	bcf1_t * line;
-	while(bcf_sr_next_line (sr)) {
-		line =  bcf_sr_get_line(sr, 0);
-		if (line->n_allele == 2) n_variants++;
-	}
-	bcf_sr_destroy(sr);
-	if (n_variants == 0) vrb.error("No variants to be phased in [" + fmain + "]");
-	vrb.bullet("VCF/BCF scanning [N=" + stb.str(n_main_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
-}
-
-void genotype_reader::scanGenotypes(string fmain, string fref) {
-	vrb.wait("  * VCF/BCF scanning");
-	tac.clock();
-	bcf_srs_t * sr =  bcf_sr_init();
-	sr->collapse = COLLAPSE_NONE;
-	sr->require_index = 1;
-	if (bcf_sr_set_regions(sr, region.c_str(), 0) == -1) vrb.error("Impossible to jump to region [" + region + "] in [" + fmain + "]");
-	if(!(bcf_sr_add_reader (sr, fmain.c_str()))) vrb.error("Problem opening index file for [" + fmain + "]");
-	if(!(bcf_sr_add_reader (sr, fref.c_str()))) vrb.error("Problem opening index file for [" + fref + "]");
-	n_variants = 0;
-	n_main_samples = bcf_hdr_nsamples(sr->readers[0].header);
-	n_ref_samples = bcf_hdr_nsamples(sr->readers[1].header);
-	int nset;
-	bcf1_t * line_main, * line_ref;
-	while ((nset = bcf_sr_next_line (sr))) {
-		if (nset == 2) {
-			line_main =  bcf_sr_get_line(sr, 0);
-			line_ref =  bcf_sr_get_line(sr, 1);
-			if (line_main->n_allele == 2 && line_ref->n_allele == 2) n_variants ++;
-		}
-	}
-	bcf_sr_destroy(sr);
-	if (n_variants == 0) vrb.error("No variants to be phased in files");
-	vrb.bullet("VCF/BCF scanning [Nm=" + stb.str(n_main_samples) + " / Nr=" + stb.str(n_ref_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
-}
@@ -33,7 +33,7 @@ gmap_reader::~gmap_reader() {
 void gmap_reader::readGeneticMapFile(string fmap) {
 	tac.clock();
 	string buffer;
-	vector < string > tokens;
+	const char * tokens [3];
 	int line = 0;
 	input_file fd_gmap(fmap);
 	if (fd_gmap.fail()) vrb.error("Cannot open genetic map file");
@@ -41,16 +41,27 @@ void gmap_reader::readGeneticMapFile(string fmap) {
 	int prev_bp = 0;
 	double prev_cm = 0;
 	while (getline(fd_gmap, buffer, '\n')) {
-		if (stb.split(buffer, tokens) == 3) {
-			int curr_bp = atoi(tokens[0].c_str());
-			double curr_cm = atof(tokens[2].c_str());
+		//Tokenize in place: locate the first three space/tab separated fields and count the rest
+		int n_tokens = 0;
+		const char * p = buffer.c_str(), * e = p + buffer.size();
+		if (e > p && *(e-1) == '\r') e--;
+		while (p < e) {
+			while (p < e && (*p == ' ' || *p == '\t')) p++;
+			if (p == e) break;
+			if (n_tokens < 3) tokens[n_tokens] = p;
+			n_tokens ++;
+			while (p < e && *p != ' ' && *p != '\t') p++;
+		}
+		if (n_tokens == 3) {
+			int curr_bp = strtol(tokens[0], NULL, 10);
+			double curr_cm = strtod(tokens[2], NULL);
 			if (curr_bp < prev_bp || curr_cm < prev_cm)
 				vrb.error("Wrong order in your genetic map file " + stb.str(prev_bp) + "bp / " + stb.str(prev_cm,5) + "cM > " + stb.str(curr_bp) + "bp / " + stb.str(curr_cm,5) + "cM");
 			pos_bp.push_back(curr_bp);
 			pos_cm.push_back(curr_cm);
 			prev_bp = curr_bp;
 			prev_cm = curr_cm;
-		} else vrb.error("Parsing line " + stb.str(line) + " : incorrect number of columns, observed: " + stb.str(tokens.size()) + " expected: 3");
+		} else vrb.error("Parsing line " + stb.str(line) + " : incorrect number of columns, observed: " + stb.str(n_tokens) + " expected: 3");
 		line++;
 	}
 	fd_gmap.close();
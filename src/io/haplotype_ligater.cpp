@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/haplotype_ligater.h>
+
+haplotype_ligater::haplotype_ligater(htsThreadPool * _pool) {
+	pool = _pool;
+	fp = NULL;
+	hdr = NULL;
+	rec = NULL;
+	file_type = OFILE_VCFU;
+	write_index = false;
+	n_ind = 0;
+	row_bytes = 0;
+	n_written = 0;
+}
+
+haplotype_ligater::~haplotype_ligater() {
+	if (rec) bcf_destroy1(rec);
+	if (hdr) bcf_hdr_destroy(hdr);
+	rec = NULL;
+	hdr = NULL;
+	vector < unsigned char > ().swap(Hb);
+}
+
+void haplotype_ligater::open(string _fname, bool _write_index, genotype_set & G, variant_map & V) {
+	fname = _fname;
+	write_index = _write_index;
+	fp = haplotype_writer::openFile(fname, pool, file_type);
+	hdr = haplotype_writer::writeHeader(fp, G, V);
+	fidx = "";
+	if (write_index && file_type != OFILE_VCFU) haplotype_writer::initIndex(fp, hdr, fname, file_type, fidx);
+
+	n_ind = G.n_ind;
+	row_bytes = (2UL * n_ind + 7) / 8;
+	n_written = 0;
+	rec = bcf_init1();
+	genotypes = vector < int > (2 * n_ind + 8);
+}
+
+void haplotype_ligater::ligate(haplotype_set & H, genotype_set & G, variant_map & V) {
+	tac.clock();
+	assert((unsigned int)G.n_ind == n_ind);
+
+	//Target haplotypes of the chunk, i.e. the first 2 * n_ind bits of each row of H_opt_var
+	unsigned long src_bytes = H.H_opt_var.n_cols/8;
+	unsigned char tail_mask = ((2 * n_ind) % 8)?(0xFF << (8 - (2 * n_ind) % 8)):0xFF;
+	vector < unsigned char > Hn = vector < unsigned char > (((unsigned long)V.size()) * row_bytes);
+	for (int l = 0 ; l < V.size() ; l ++) {
+		memcpy(&Hn[l * row_bytes], H.H_opt_var.bytes + ((unsigned long)l) * src_bytes, row_bytes);
+		Hn[(l + 1) * row_bytes - 1] &= tail_mask;
+	}
+
+	//First chunk: nothing to ligate with
+	if (Vb.size() == 0) {
+		Vb = V;
+		Hb.swap(Hn);
+		vrb.bullet("Ligation [first chunk / L=" + stb.str(Vb.size()) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+		return;
+	}
+
+	//Variants shared by the buffered chunk and the new one, matched on position and alleles
+	vector < pair < int, int > > shared;
+	for (int i = Vb.lowerBound(V.vec_bp[0]), j = 0 ; i < Vb.size() && j < V.size() ; ) {
+		if (Vb.vec_bp[i] < V.vec_bp[j]) i ++;
+		else if (Vb.vec_bp[i] > V.vec_bp[j]) j ++;
+		else if (!strcmp(Vb.ref(i), V.ref(j)) && !strcmp(Vb.alt(i), V.alt(j))) shared.push_back(pair < int, int > (i++, j++));
+		else i ++;
+	}
+
+	//Phase agreement at the sites heterozygous in both chunks; pairs of haplotypes sit at bits 7-6, 5-4, 3-2 and 1-0 of a byte
+	vector < unsigned int > n_agree = vector < unsigned int > (n_ind, 0), n_disagree = vector < unsigned int > (n_ind, 0);
+	for (unsigned long s = 0 ; s < shared.size() ; s ++) {
+		const unsigned char * a = &Hb[shared[s].first * row_bytes], * b = &Hn[shared[s].second * row_bytes];
+		for (unsigned long k = 0 ; k < row_bytes ; k ++) {
+			unsigned char het = ((a[k] ^ (a[k] << 1)) & (b[k] ^ (b[k] << 1))) & 0xAA;
+			if (!het) continue;
+			unsigned char same = ~(a[k] ^ b[k]);
+			for (int p = 0 ; p < 4 ; p ++) if (het & (0x80 >> (2 * p))) {
+				if (same & (0x80 >> (2 * p))) n_agree[4 * k + p] ++;
+				else n_disagree[4 * k + p] ++;
+			}
+		}
+	}
+	vector < unsigned char > flip = vector < unsigned char > (row_bytes, 0);
+	unsigned int n_flipped = 0, n_unlinked = 0;
+	for (unsigned int i = 0 ; i < n_ind ; i ++) {
+		if (n_disagree[i] > n_agree[i]) { flip[i/4] |= 0xC0 >> (2 * (i%4)); n_flipped ++; }
+		if (n_agree[i] + n_disagree[i] == 0) n_unlinked ++;
+	}
+
+	//Switch chunks in the middle of the shared variants
+	int cut_bp = shared.size()?Vb.vec_bp[shared[shared.size()/2].first]:V.vec_bp[0];
+	if (shared.empty()) vrb.warning("No variant shared by consecutive chunks, haplotypes are not ligated at position " + stb.str(cut_bp));
+	writeBuffer(0, Vb.lowerBound(cut_bp));
+
+	//Keep the new chunk from the cut, flipped where needed
+	variant_map Vn;
+	int l0 = V.lowerBound(cut_bp);
+	Hb = vector < unsigned char > (((unsigned long)(V.size() - l0)) * row_bytes);
+	for (int l = l0 ; l < V.size() ; l ++) {
+		Vn.push(V.chr(l).c_str(), V.vec_bp[l], V.id(l), V.ref(l), V.alt(l), V.vec_cref[l], V.vec_calt[l], V.vec_cmis[l]);
+		Vn.vec_cm.back() = V.vec_cm[l];
+		const unsigned char * src = &Hn[l * row_bytes];
+		unsigned char * dst = &Hb[(l - l0) * row_bytes];
+		for (unsigned long k = 0 ; k < row_bytes ; k ++) dst[k] = (src[k] & ~flip[k]) | ((src[k] & flip[k] & 0xAA) >> 1) | ((src[k] & flip[k] & 0x55) << 1);
+	}
+	Vb = Vn;
+	vrb.bullet("Ligation [shared L=" + stb.str(shared.size()) + " / cut=" + stb.str(cut_bp) + " / flipped=" + stb.str(n_flipped * 100.0 / n_ind, 1) + "% / unlinked=" + stb.str(n_unlinked * 100.0 / n_ind, 1) + "%] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+void haplotype_ligater::writeBuffer(int from, int to) {
+	for (int l = from ; l < to ; l ++) {
+		haplotype_writer::encodeRecord(hdr, rec, Vb, l, &Hb[((unsigned long)l) * row_bytes], 2 * n_ind, genotypes.data());
+		if (bcf_write1(fp, hdr, rec)) vrb.error("Non zero status when writing record in [" + fname + "]");
+		n_written ++;
+	}
+}
+
+void haplotype_ligater::close() {
+	tac.clock();
+	writeBuffer(0, Vb.size());
+	haplotype_writer::closeFile(fp, fidx);
+	fp = NULL;
+	haplotype_writer::verboseWriting(file_type, write_index, n_ind, n_written, stb.str(tac.rel_time()*1.0/1000, 2) + "s");
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _HAPLOTYPE_LIGATER_H
+#define _HAPLOTYPE_LIGATER_H
+
+#include <utils/otools.h>
+
+#include <containers/variant_map.h>
+#include <containers/haplotype_set.h>
+#include <containers/genotype_set.h>
+
+#include <io/haplotype_writer.h>
+
+/*
+ * Ligates the haplotypes of overlapping chunks phased one after the other into a single VCF/BCF file.
+ * Only the target haplotypes of the last chunk are kept in memory: when the next chunk comes, the haplotypes
+ * of each individual are flipped or not so that they agree best with the previous chunk at the heterozygous
+ * sites of the overlap; the previous chunk is then written up to the middle of the overlap and the next one
+ * is kept from there.
+ */
+class haplotype_ligater {
+public:
+	//DATA
+	htsThreadPool * pool;
+	htsFile * fp;
+	bcf_hdr_t * hdr;
+	bcf1_t * rec;
+	string fname;
+	string fidx;						//Index file, empty when not indexing (kept alive until the index is saved)
+	unsigned int file_type;
+	bool write_index;
+	unsigned int n_ind;
+	unsigned long row_bytes;			//Bytes per variant of the buffered haplotypes, ceil(2 * n_ind / 8)
+
+	//BUFFERED CHUNK
+	variant_map Vb;						//Variants of the chunk not written yet
+	vector < unsigned char > Hb;		//Target haplotypes of these variants, one row of row_bytes per variant (H_opt_var layout)
+
+	//COUNTS
+	unsigned long n_written;
+	vector < int > genotypes;
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	haplotype_ligater(htsThreadPool * pool = NULL);
+	~haplotype_ligater();
+
+	//IO
+	void open(string foutput, bool write_index, genotype_set &, variant_map &);
+	void ligate(haplotype_set &, genotype_set &, variant_map &);
+	void writeBuffer(int, int);
+	void close();
+};
+
+#endif
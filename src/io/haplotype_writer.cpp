@@ -21,78 +21,190 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <io/haplotype_writer.h>
 
-#define OFILE_VCFU	0
-#define OFILE_VCFC	1
-#define OFILE_BCFC	2
-
-haplotype_writer::haplotype_writer(haplotype_set & _H, genotype_set & _G, variant_map & _V): H(_H), G(_G), V(_V) {
+haplotype_writer::haplotype_writer(haplotype_set & _H, genotype_set & _G, variant_map & _V, htsThreadPool * _pool, int _n_thread): H(_H), G(_G), V(_V) {
+	pool = _pool;
+	hdr = NULL;
+	n_thread = _n_thread;
+	n_blocks = 0;
+	n_slots = 0;
+	i_workers = 0;
+	pthread_mutex_init(&mutex_workers, NULL);
+	pthread_cond_init(&cond_workers, NULL);
 }
 
 haplotype_writer::~haplotype_writer() {
+	pthread_mutex_destroy(&mutex_workers);
+	pthread_cond_destroy(&cond_workers);
 }
 
-void haplotype_writer::writeHaplotypes(string fname) {
-	// Init
-	tac.clock();
+//Phased GT values of the 8 haplotypes packed in one byte of H_opt_var (most significant bit first), filled at start-up
+static int gt_lut[256][8];
+static struct gt_lut_filler {
+	gt_lut_filler() { for (int v = 0 ; v < 256 ; v ++) for (int j = 0 ; j < 8 ; j ++) gt_lut[v][j] = bcf_gt_phased((v >> (7 - j)) & 1); }
+} gt_lut_fill;
+
+htsFile * haplotype_writer::openFile(string fname, htsThreadPool * pool, unsigned int & file_type) {
 	string file_format = "w";
-	unsigned int file_type = OFILE_VCFU;
+	file_type = OFILE_VCFU;
 	if (fname.size() > 6 && fname.substr(fname.size()-6) == "vcf.gz") { file_format = "wz"; file_type = OFILE_VCFC; }
 	if (fname.size() > 3 && fname.substr(fname.size()-3) == "bcf") { file_format = "wb"; file_type = OFILE_BCFC; }
 	htsFile * fp = hts_open(fname.c_str(),file_format.c_str());
+	if (!fp) vrb.error("Impossible to create [" + fname + "]");
+	if (pool && file_type != OFILE_VCFU && hts_set_thread_pool(fp, pool)) vrb.error("Impossible to attach the thread pool to [" + fname + "]");
+	return fp;
+}
+
+bcf_hdr_t * haplotype_writer::writeHeader(htsFile * fp, genotype_set & G, variant_map & V) {
 	bcf_hdr_t * hdr = bcf_hdr_init("w");
-	bcf1_t *rec = bcf_init1();
 
 	// Create VCF header
 	bcf_hdr_append(hdr, string("##fileDate="+tac.date()).c_str());
 	bcf_hdr_append(hdr, "##source=G2H");
-	bcf_hdr_append(hdr, string("##contig=<ID="+ V.vec_pos[0]->chr + ">").c_str());
+	bcf_hdr_append(hdr, string("##contig=<ID="+ V.chr(0) + ">").c_str());
 	bcf_hdr_append(hdr, "##INFO=<ID=AF,Number=A,Type=Float,Description=\"Allele Frequency\">");
 	bcf_hdr_append(hdr, "##INFO=<ID=AC,Number=1,Type=Integer,Description=\"Allele count\">");
 	bcf_hdr_append(hdr, "##INFO=<ID=CM,Number=A,Type=Float,Description=\"Interpolated cM position\">");
 	bcf_hdr_append(hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Phased genotypes\">");
 
 	//Add samples
-	for (int i = 0 ; i < G.n_ind ; i ++) bcf_hdr_add_sample(hdr, G.vecG[i]->name.c_str());
+	for (int i = 0 ; i < G.n_ind ; i ++) bcf_hdr_add_sample(hdr, G.vecG[i]->name);
 	bcf_hdr_add_sample(hdr, NULL);      // to update internal structures
 	bcf_hdr_write(fp, hdr);
+	return hdr;
+}
 
-	//Add records
-	int * genotypes = (int*)malloc(bcf_hdr_nsamples(hdr)*2*sizeof(int));
-	for (int l = 0 ; l < V.size() ; l ++) {
-		bcf_clear1(rec);
-		rec->rid = bcf_hdr_name2id(hdr, V.vec_pos[l]->chr.c_str());
-		rec->pos = V.vec_pos[l]->bp - 1;
-		bcf_update_id(hdr, rec, V.vec_pos[l]->id.c_str());
-		string alleles = V.vec_pos[l]->ref + "," + V.vec_pos[l]->alt;
-		bcf_update_alleles_str(hdr, rec, alleles.c_str());
-		int count_alt = 0;
-		for (int i = 0 ; i < G.n_ind ; i++) {
-			bool a0 = H.H_opt_var.get(l, 2*i+0);
-			bool a1 = H.H_opt_var.get(l, 2*i+1);
-			//bool a0 = H.H_opt_hap.get(2*i+0, l);
-			//bool a1 = H.H_opt_hap.get(2*i+1, l);
-			count_alt += a0+a1;
-			genotypes[2*i+0] = bcf_gt_phased(a0);
-			genotypes[2*i+1] = bcf_gt_phased(a1);
-		}
-		bcf_update_info_int32(hdr, rec, "AC", &count_alt, 1);
-		float freq_alt = count_alt * 1.0 / (2 * G.n_ind);
-		bcf_update_info_float(hdr, rec, "AF", &freq_alt, 1);
-		if (V.vec_pos[l]->cm >= 0) {
-			float val = (float)V.vec_pos[l]->cm;
-			bcf_update_info_float(hdr, rec, "CM", &val, 1);
-		}
-		bcf_update_genotypes(hdr, rec, genotypes, bcf_hdr_nsamples(hdr)*2);
-		bcf_write1(fp, hdr, rec);
-		vrb.progress("  * VCF writing", (l+1)*1.0/V.size());
-	}
-	free(genotypes);
-	bcf_destroy1(rec);
-	bcf_hdr_destroy(hdr);
+void haplotype_writer::initIndex(htsFile * fp, bcf_hdr_t * hdr, string fname, unsigned int file_type, string & fidx) {
+	//Index built while writing: TBI (min_shift=0) for VCF.gz, CSI (min_shift=14) for BCF, saved next to the output file
+	//htslib keeps a pointer to the index filename until bcf_idx_save, so fidx must outlive the writing
+	fidx = fname + ((file_type == OFILE_BCFC)?".csi":".tbi");
+	if (bcf_idx_init(fp, hdr, (file_type == OFILE_BCFC)?14:0, fidx.c_str())) vrb.error("Impossible to initialise index for [" + fname + "]");
+}
+
+void haplotype_writer::closeFile(htsFile * fp, string fidx) {
+	if (!fidx.empty() && bcf_idx_save(fp)) vrb.error("Impossible to save index [" + fidx + "]");
 	if (hts_close(fp)) vrb.error("Non zero status when closing VCF/BCF file descriptor");
+}
+
+void haplotype_writer::verboseWriting(unsigned int file_type, bool write_index, unsigned int n_ind, unsigned long n_variants, string str_time) {
 	switch (file_type) {
-	case OFILE_VCFU: vrb.bullet("VCF writing [Uncompressed / N=" + stb.str(G.n_ind) + " / L=" + stb.str(V.size()) + "] (" + stb.str(tac.rel_time()*0.001, 2) + "s)"); break;
-	case OFILE_VCFC: vrb.bullet("VCF writing [Compressed / N=" + stb.str(G.n_ind) + " / L=" + stb.str(V.size()) + "] (" + stb.str(tac.rel_time()*0.001, 2) + "s)"); break;
-	case OFILE_BCFC: vrb.bullet("BCF writing [Compressed / N=" + stb.str(G.n_ind) + " / L=" + stb.str(V.size()) + "] (" + stb.str(tac.rel_time()*0.001, 2) + "s)"); break;
+	case OFILE_VCFU: vrb.bullet("VCF writing [Uncompressed / N=" + stb.str(n_ind) + " / L=" + stb.str(n_variants) + "] (" + str_time + ")"); break;
+	case OFILE_VCFC: vrb.bullet("VCF writing [Compressed" + string(write_index?" / TBI":"") + " / N=" + stb.str(n_ind) + " / L=" + stb.str(n_variants) + "] (" + str_time + ")"); break;
+	case OFILE_BCFC: vrb.bullet("BCF writing [Compressed" + string(write_index?" / CSI":"") + " / N=" + stb.str(n_ind) + " / L=" + stb.str(n_variants) + "] (" + str_time + ")"); break;
+	}
+}
+
+void haplotype_writer::encodeRecord(bcf_hdr_t * hdr, bcf1_t * rec, variant_map & V, int l, const unsigned char * row, unsigned int n_hap_main, int * genotypes) {
+	unsigned int n_full_bytes = n_hap_main / 8, n_tail_bits = n_hap_main % 8;
+	unsigned char tail_mask = n_tail_bits?(0xFF << (8 - n_tail_bits)):0;
+	bcf_clear1(rec);
+	rec->rid = bcf_hdr_name2id(hdr, V.chr(l).c_str());
+	rec->pos = V.vec_bp[l] - 1;
+	bcf_update_id(hdr, rec, V.id(l));
+	string alleles = string(V.ref(l)) + "," + V.alt(l);
+	bcf_update_alleles_str(hdr, rec, alleles.c_str());
+	//Genotypes straight from the packed row of the variant, 8 haplotypes at a time
+	int count_alt = 0;
+	for (unsigned int k = 0 ; k < n_full_bytes ; k ++) {
+		memcpy(genotypes + 8 * k, gt_lut[row[k]], 8 * sizeof(int));
+		count_alt += __builtin_popcount(row[k]);
 	}
+	if (n_tail_bits) {
+		memcpy(genotypes + 8 * n_full_bytes, gt_lut[row[n_full_bytes]], 8 * sizeof(int));
+		count_alt += __builtin_popcount(row[n_full_bytes] & tail_mask);
+	}
+	bcf_update_info_int32(hdr, rec, "AC", &count_alt, 1);
+	float freq_alt = count_alt * 1.0 / n_hap_main;
+	bcf_update_info_float(hdr, rec, "AF", &freq_alt, 1);
+	if (V.vec_cm[l] >= 0) {
+		float val = (float)V.vec_cm[l];
+		bcf_update_info_float(hdr, rec, "CM", &val, 1);
+	}
+	bcf_update_genotypes(hdr, rec, genotypes, n_hap_main);
+}
+
+void haplotype_writer::encodeBlock(int b, int * genotypes) {
+	vector < bcf1_t * > & R = slotRecords[b % n_slots];
+	for (int l = b * WRITE_BLOCK, r = 0 ; l < V.size() && r < WRITE_BLOCK ; l ++, r ++)
+		encodeRecord(hdr, R[r], V, l, H.H_opt_var.bytes + ((unsigned long)l) * (H.H_opt_var.n_cols/8), 2 * G.n_ind, genotypes);
+}
+
+void haplotype_writer::encodeBlockInSlot(int b, int * genotypes) {
+	int slot = b % n_slots;
+	pthread_mutex_lock(&mutex_workers);
+	while (slotWritable[slot] != b) pthread_cond_wait(&cond_workers, &mutex_workers);
+	pthread_mutex_unlock(&mutex_workers);
+	encodeBlock(b, genotypes);
+	pthread_mutex_lock(&mutex_workers);
+	slotEncoded[slot] = b;
+	pthread_cond_broadcast(&cond_workers);
+	pthread_mutex_unlock(&mutex_workers);
+}
+
+void * encoding_callback(void * ptr) {
+	haplotype_writer * S = static_cast< haplotype_writer * >( ptr );
+	int * genotypes = (int*)malloc((2 * S->G.n_ind + 8) * sizeof(int));
+	while (1) {
+		pthread_mutex_lock( &S->mutex_workers );
+		int curr_block_to_process = S->i_workers++;
+		pthread_mutex_unlock( &S->mutex_workers);
+		if (curr_block_to_process < S->n_blocks) S->encodeBlockInSlot(curr_block_to_process, genotypes);
+		else break;
+	}
+	free(genotypes);
+	pthread_exit(NULL);
+}
+
+void haplotype_writer::writeHaplotypes(string fname, bool write_index) {
+	// Init
+	tac.clock();
+	unsigned int file_type;
+	htsFile * fp = openFile(fname, pool, file_type);
+	double t_write = 0.0;
+	std::chrono::time_point<std::chrono::high_resolution_clock> t0;
+	hdr = writeHeader(fp, G, V);
+	string fidx = "";
+	if (write_index && file_type != OFILE_VCFU) initIndex(fp, hdr, fname, file_type, fidx);
+
+	//Encode blocks of records in parallel, write them in order from this thread
+	n_blocks = (V.size() + WRITE_BLOCK - 1) / WRITE_BLOCK;
+	n_slots = (n_thread > 1)?(2 * n_thread):1;
+	slotRecords = vector < vector < bcf1_t * > > (n_slots, vector < bcf1_t * > (WRITE_BLOCK));
+	for (int s = 0 ; s < n_slots ; s ++) for (int r = 0 ; r < WRITE_BLOCK ; r ++) slotRecords[s][r] = bcf_init1();
+	slotEncoded = vector < int > (n_slots, -1);
+	slotWritable = vector < int > (n_slots);
+	for (int s = 0 ; s < n_slots ; s ++) slotWritable[s] = s;
+	i_workers = 0;
+	int * genotypes = NULL;
+	if (n_thread > 1) {
+		id_workers = vector < pthread_t > (n_thread);
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, encoding_callback, static_cast<void *>(this));
+	} else genotypes = (int*)malloc((2 * G.n_ind + 8) * sizeof(int));
+	for (int b = 0 ; b < n_blocks ; b ++) {
+		int slot = b % n_slots;
+		if (n_thread > 1) {
+			pthread_mutex_lock(&mutex_workers);
+			while (slotEncoded[slot] != b) pthread_cond_wait(&cond_workers, &mutex_workers);
+			pthread_mutex_unlock(&mutex_workers);
+		} else encodeBlock(b, genotypes);
+		t0 = std::chrono::high_resolution_clock::now();
+		for (int l = b * WRITE_BLOCK, r = 0 ; l < V.size() && r < WRITE_BLOCK ; l ++, r ++) if (bcf_write1(fp, hdr, slotRecords[slot][r])) vrb.error("Non zero status when writing record in [" + fname + "]");
+		t_write += std::chrono::duration < double, std::milli > (std::chrono::high_resolution_clock::now() - t0).count();
+		pthread_mutex_lock(&mutex_workers);
+		slotWritable[slot] = b + n_slots;
+		pthread_cond_broadcast(&cond_workers);
+		pthread_mutex_unlock(&mutex_workers);
+		vrb.progress("  * VCF writing", min(V.size(), (b+1) * WRITE_BLOCK)*1.0/V.size());
+	}
+	if (n_thread > 1) for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+	else free(genotypes);
+	for (int s = 0 ; s < n_slots ; s ++) for (int r = 0 ; r < WRITE_BLOCK ; r ++) bcf_destroy1(slotRecords[s][r]);
+	slotRecords.clear();
+	t0 = std::chrono::high_resolution_clock::now();
+	closeFile(fp, fidx);
+	bcf_hdr_destroy(hdr);
+	hdr = NULL;
+	t_write += std::chrono::duration < double, std::milli > (std::chrono::high_resolution_clock::now() - t0).count();
+	double t_total = tac.rel_time();
+	string str_time = "Encode=" + stb.str(max(0.0, t_total-t_write)*0.001, 2) + "s / Write=" + stb.str(t_write*0.001, 2) + "s";
+	verboseWriting(file_type, write_index, G.n_ind, V.size(), str_time);
 }
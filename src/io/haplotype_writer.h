@@ -29,19 +29,72 @@
 #include <containers/genotype_set.h>
 
 
+#define OFILE_VCFU	0
+#define OFILE_VCFC	1
+#define OFILE_BCFC	2
+
+#define WRITE_BLOCK	256		//Number of sites encoded at once by a worker
+
+/*
+ * Binary haplotype format (--output-binary), all integers little-endian:
+ *
+ * [HEADER, 64 bytes]
+ *   char[8]  magic "SHP4HAP" + version byte (1)
+ *   uint32   flags (bit 0: blocks are deflated with zlib)
+ *   uint32   block_size, number of sites per block
+ *   uint64   n_samples
+ *   uint64   n_sites
+ *   uint64   row_bytes, bytes per site = ceil(2 * n_samples / 8)
+ *   uint64   offset of the sample table
+ *   uint64   offset of the site table
+ *   uint64   offset of the block index
+ * [SAMPLE TABLE] n_samples null-terminated names
+ * [SITE TABLE]   n_sites records: uint32 position, float cM (-1 if unknown), then chr, id, ref, alt null-terminated
+ * [BLOCKS]       block b holds sites [b*block_size, min((b+1)*block_size, n_sites)), one row of row_bytes per site.
+ *                Haplotype h of a site is bit (7 - h%8) of byte h/8 of its row, haplotypes 2i and 2i+1 are sample i.
+ *                Unused bits of the last byte are 0.
+ * [BLOCK INDEX]  ceil(n_sites / block_size) records: uint64 offset of the block, uint64 stored bytes
+ *
+ * A site range is read by loading the header and the block index, then only the blocks overlapping it.
+ */
+#define BINARY_BLOCK	4096
+
 class haplotype_writer {
 public:
 	//DATA
 	haplotype_set & H;
 	genotype_set & G;
 	variant_map & V;
+	htsThreadPool * pool;
+	bcf_hdr_t * hdr;
+
+	//MULTI-THREADING
+	int n_thread, n_blocks, n_slots;
+	int i_workers;
+	pthread_mutex_t mutex_workers;
+	pthread_cond_t cond_workers;
+	vector < pthread_t > id_workers;
+	vector < vector < bcf1_t * > > slotRecords;	//Records of the blocks in flight, one slot per block modulo n_slots
+	vector < int > slotEncoded;					//Block last encoded in each slot
+	vector < int > slotWritable;				//Block allowed to be encoded next in each slot (once the previous one has been written)
 
 	//CONSTRUCTORS/DESCTRUCTORS
-	haplotype_writer(haplotype_set &, genotype_set &, variant_map &);
+	haplotype_writer(haplotype_set &, genotype_set &, variant_map &, htsThreadPool * pool = NULL, int n_thread = 1);
 	~haplotype_writer();
 
+	//VCF/BCF HELPERS (shared with haplotype_ligater)
+	static htsFile * openFile(string, htsThreadPool *, unsigned int &);
+	static bcf_hdr_t * writeHeader(htsFile *, genotype_set &, variant_map &);
+	static void initIndex(htsFile *, bcf_hdr_t *, string, unsigned int, string &);
+	static void closeFile(htsFile *, string);
+	static void verboseWriting(unsigned int, bool, unsigned int, unsigned long, string);
+	static void encodeRecord(bcf_hdr_t *, bcf1_t *, variant_map &, int, const unsigned char *, unsigned int, int *);
+
 	//IO
-	void writeHaplotypes(string foutput);
+	void encodeBlock(int, int *);
+	void encodeBlockInSlot(int, int *);
+	void writeHaplotypes(string foutput, bool write_index = false);
+	void writeHaplotypesBinary(string foutput, bool compress);
 };
 
 #endif
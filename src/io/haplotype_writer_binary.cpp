@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/haplotype_writer.h>
+
+#include <zlib.h>
+
+template < typename T >
+static void writeBinary(std::ofstream & fd, T value) {
+	fd.write(reinterpret_cast < char * > (&value), sizeof(T));
+}
+
+static void writeString(std::ofstream & fd, const string & str) {
+	fd.write(str.c_str(), str.size() + 1);
+}
+
+void haplotype_writer::writeHaplotypesBinary(string fname, bool compress) {
+	tac.clock();
+	std::ofstream fd (fname.c_str(), std::ios::out | std::ios::binary);
+	if (!fd.is_open()) vrb.error("Impossible to create [" + fname + "]");
+
+	unsigned long n_sites = V.size(), n_samples = G.n_ind;
+	unsigned long row_bytes = (2 * n_samples + 7) / 8;
+	unsigned long n_blocks = (n_sites + BINARY_BLOCK - 1) / BINARY_BLOCK;
+	unsigned int n_tail_bits = (2 * n_samples) % 8;
+	unsigned char tail_mask = n_tail_bits?(0xFF << (8 - n_tail_bits)):0xFF;
+
+	//Header, offsets are filled in once known
+	char magic [8] = { 'S', 'H', 'P', '4', 'H', 'A', 'P', 1 };
+	fd.write(magic, 8);
+	writeBinary < unsigned int > (fd, compress?1U:0U);
+	writeBinary < unsigned int > (fd, BINARY_BLOCK);
+	writeBinary < unsigned long > (fd, n_samples);
+	writeBinary < unsigned long > (fd, n_sites);
+	writeBinary < unsigned long > (fd, row_bytes);
+	for (int o = 0 ; o < 3 ; o ++) writeBinary < unsigned long > (fd, 0UL);
+
+	//Sample table
+	unsigned long offset_samples = fd.tellp();
+	for (int i = 0 ; i < G.n_ind ; i ++) writeString(fd, string(G.vecG[i]->name));
+
+	//Site table
+	unsigned long offset_sites = fd.tellp();
+	for (int l = 0 ; l < n_sites ; l ++) {
+		writeBinary < unsigned int > (fd, V.vec_bp[l]);
+		writeBinary < float > (fd, (V.vec_cm[l] >= 0)?((float)V.vec_cm[l]):-1.0f);
+		writeString(fd, V.chr(l));
+		writeString(fd, string(V.id(l)));
+		writeString(fd, string(V.ref(l)));
+		writeString(fd, string(V.alt(l)));
+	}
+
+	//Blocks of packed rows, copied from H_opt_var without the reference haplotypes
+	vector < unsigned long > block_offsets = vector < unsigned long > (n_blocks), block_sizes = vector < unsigned long > (n_blocks);
+	vector < unsigned char > raw = vector < unsigned char > (BINARY_BLOCK * row_bytes);
+	vector < unsigned char > packed = vector < unsigned char > (compress?compressBound(raw.size()):0);
+	unsigned long n_stored = 0;
+	for (unsigned long b = 0 ; b < n_blocks ; b ++) {
+		unsigned long l_start = b * BINARY_BLOCK, l_end = min(n_sites, l_start + BINARY_BLOCK);
+		for (unsigned long l = l_start ; l < l_end ; l ++) {
+			unsigned char * row = &raw[(l - l_start) * row_bytes];
+			memcpy(row, H.H_opt_var.bytes + l * (H.H_opt_var.n_cols/8), row_bytes);
+			row[row_bytes - 1] &= tail_mask;
+		}
+		unsigned long raw_bytes = (l_end - l_start) * row_bytes;
+		block_offsets[b] = fd.tellp();
+		if (compress) {
+			uLongf packed_bytes = packed.size();
+			if (compress2(packed.data(), &packed_bytes, raw.data(), raw_bytes, Z_DEFAULT_COMPRESSION) != Z_OK) vrb.error("Impossible to compress block [" + stb.str(b) + "] of [" + fname + "]");
+			fd.write(reinterpret_cast < char * > (packed.data()), packed_bytes);
+			block_sizes[b] = packed_bytes;
+		} else {
+			fd.write(reinterpret_cast < char * > (raw.data()), raw_bytes);
+			block_sizes[b] = raw_bytes;
+		}
+		n_stored += block_sizes[b];
+		vrb.progress("  * Binary writing", l_end * 1.0 / n_sites);
+	}
+
+	//Block index, then header offsets
+	unsigned long offset_index = fd.tellp();
+	for (unsigned long b = 0 ; b < n_blocks ; b ++) {
+		writeBinary < unsigned long > (fd, block_offsets[b]);
+		writeBinary < unsigned long > (fd, block_sizes[b]);
+	}
+	fd.seekp(40);
+	writeBinary < unsigned long > (fd, offset_samples);
+	writeBinary < unsigned long > (fd, offset_sites);
+	writeBinary < unsigned long > (fd, offset_index);
+	fd.close();
+	if (fd.fail()) vrb.error("Non zero status when closing binary haplotype file [" + fname + "]");
+	vrb.bullet("Binary writing [" + string(compress?"Deflated":"Raw") + " / N=" + stb.str(n_samples) + " / L=" + stb.str(n_sites) + " / Haps=" + stb.str(n_stored * 1.0 / (1024 * 1024), 2) + "MB] (" + stb.str(tac.rel_time()*0.001, 2) + "s)");
+}
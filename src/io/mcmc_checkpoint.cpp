@@ -0,0 +1,188 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/mcmc_checkpoint.h>
+
+static const char checkpoint_magic [8] = { 'S', 'H', 'P', '4', 'C', 'K', 'P', 2 };
+
+template < typename T >
+static void pushScalar(vector < char > & buffer, T value) {
+	const char * ptr = reinterpret_cast < const char * > (&value);
+	buffer.insert(buffer.end(), ptr, ptr + sizeof(T));
+}
+
+template < typename T >
+static void pushArray(vector < char > & buffer, const T * data, unsigned long n) {
+	pushScalar < unsigned long > (buffer, n);
+	const char * ptr = reinterpret_cast < const char * > (data);
+	buffer.insert(buffer.end(), ptr, ptr + n * sizeof(T));
+}
+
+template < typename T >
+static T readScalar(std::ifstream & fd) {
+	T value = T();
+	fd.read(reinterpret_cast < char * > (&value), sizeof(T));
+	return value;
+}
+
+template < typename T >
+static void readArray(std::ifstream & fd, T * data, unsigned long n, string & fname) {
+	if (readScalar < unsigned long > (fd) != n) vrb.error("Checkpoint [" + fname + "] does not match the data being phased");
+	fd.read(reinterpret_cast < char * > (data), n * sizeof(T));
+}
+
+template < typename T >
+static void readVector(std::ifstream & fd, vector < T > & data) {
+	data.resize(readScalar < unsigned long > (fd));
+	fd.read(reinterpret_cast < char * > (data.data()), data.size() * sizeof(T));
+}
+
+void * checkpoint_callback(void * ptr) {
+	static_cast < mcmc_checkpoint * > (ptr)->write();
+	pthread_exit(NULL);
+}
+
+mcmc_checkpoint::mcmc_checkpoint(haplotype_set & _H, genotype_set & _G, vector < float > & _freezeSwitches, vector < vector < unsigned int > > & _freezeK, vector < unsigned char > & _depthBlocks, string dir, string _scheme) : H(_H), G(_G), freezeSwitches(_freezeSwitches), freezeK(_freezeK), depthBlocks(_depthBlocks) {
+	fname = dir + "/shapeit4.ckpt";
+	scheme = _scheme;
+	writing = false;
+	t_write = 0.0;
+}
+
+mcmc_checkpoint::~mcmc_checkpoint() {
+	wait();
+}
+
+void mcmc_checkpoint::save(unsigned int stage, unsigned int iter, unsigned long current_iteration) {
+	tac.clock();
+	wait();
+	double t_last = t_write;
+
+	//1. Cursor, consistency key and random number generator
+	buffer.clear();
+	buffer.insert(buffer.end(), checkpoint_magic, checkpoint_magic + 8);
+	pushArray(buffer, scheme.c_str(), scheme.size());
+	pushScalar < unsigned long > (buffer, G.n_ind);
+	pushScalar < unsigned long > (buffer, G.n_site);
+	pushScalar < unsigned long > (buffer, H.n_hap);
+	pushScalar < unsigned int > (buffer, stage);
+	pushScalar < unsigned int > (buffer, iter);
+	pushScalar < unsigned long > (buffer, current_iteration);
+	std::ostringstream rng_state;
+	rng_state << rng.getEngine();
+	pushArray(buffer, rng_state.str().c_str(), rng_state.str().size());
+
+	//2. Genotype graphs
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		pushScalar < unsigned int > (buffer, g->n_segments);
+		pushScalar < unsigned int > (buffer, g->n_transitions);
+		pushArray(buffer, g->ProbMask.data(), g->ProbMask.size());
+		pushArray(buffer, g->ProbStored.data(), g->ProbStored.size());
+	}
+	if (G.sparse) pushArray(buffer, G.arenaSparse.data(), G.arenaSparse.size());
+	else pushArray(buffer, G.arenaVariants, G.n_ind * G.vstride);
+	pushArray(buffer, G.arenaAmbiguous.data(), G.arenaAmbiguous.size());
+	pushArray(buffer, G.arenaDiplotypes.data(), G.arenaDiplotypes.size());
+	pushArray(buffer, G.arenaLengths.data(), G.arenaLengths.size());
+
+	//3. Target haplotypes
+	pushArray(buffer, H.H_opt_hap.bytes, 2UL * H.n_ind * (H.H_opt_hap.n_cols / 8));
+
+	//4. Convergence and PBWT depth of each individual
+	pushArray(buffer, freezeSwitches.data(), freezeSwitches.size());
+	pushScalar < unsigned long > (buffer, freezeK.size());
+	for (unsigned long i = 0 ; i < freezeK.size() ; i ++) pushArray(buffer, freezeK[i].data(), freezeK[i].size());
+	pushArray(buffer, depthBlocks.data(), depthBlocks.size());
+
+	//5. Disk write overlaps with the next iteration
+	writing = true;
+	pthread_create(&id_writer, NULL, checkpoint_callback, static_cast < void * > (this));
+	vrb.bullet("Checkpoint [" + stb.str(buffer.size() * 1.0 / (1024 * 1024), 2) + "MB" + ((t_last > 0)?(" / previous written in background in " + stb.str(t_last*0.001, 2) + "s"):string("")) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+void mcmc_checkpoint::write() {
+	std::chrono::time_point<std::chrono::high_resolution_clock> t0 = std::chrono::high_resolution_clock::now();
+	string ftmp = fname + ".tmp";
+	//Runs in the writer thread, failures are reported by wait on the main thread
+	std::ofstream fd (ftmp.c_str(), std::ios::out | std::ios::binary);
+	if (!fd.is_open()) { write_error = "Impossible to create checkpoint [" + ftmp + "]"; return; }
+	fd.write(buffer.data(), buffer.size());
+	fd.close();
+	if (fd.fail()) { write_error = "Non zero status when closing checkpoint [" + ftmp + "]"; return; }
+	if (rename(ftmp.c_str(), fname.c_str())) { write_error = "Impossible to rename checkpoint [" + ftmp + "] into [" + fname + "]"; return; }
+	t_write = std::chrono::duration < double, std::milli > (std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+void mcmc_checkpoint::wait() {
+	if (!writing) return;
+	pthread_join(id_writer, NULL);
+	writing = false;
+	if (write_error.size()) vrb.error(write_error);
+}
+
+bool mcmc_checkpoint::load(unsigned int & stage, unsigned int & iter, unsigned long & current_iteration) {
+	tac.clock();
+	std::ifstream fd (fname.c_str(), std::ios::in | std::ios::binary);
+	if (!fd.is_open()) return false;
+	char magic [8];
+	vector < char > file_scheme;
+	if (!fd.read(magic, 8) || memcmp(magic, checkpoint_magic, 8)) vrb.error("Unsupported checkpoint [" + fname + "]");
+	readVector(fd, file_scheme);
+	if (string(file_scheme.begin(), file_scheme.end()) != scheme) vrb.error("Checkpoint [" + fname + "] was written with another iteration scheme");
+	unsigned long n_ind = readScalar < unsigned long > (fd), n_site = readScalar < unsigned long > (fd), n_hap = readScalar < unsigned long > (fd);
+	if (n_ind != (unsigned long)G.n_ind || n_site != (unsigned long)G.n_site || n_hap != H.n_hap) vrb.error("Checkpoint [" + fname + "] does not match the data being phased");
+
+	//1. Cursor and random number generator
+	stage = readScalar < unsigned int > (fd);
+	iter = readScalar < unsigned int > (fd);
+	current_iteration = readScalar < unsigned long > (fd);
+	vector < char > rng_state;
+	readVector(fd, rng_state);
+	std::istringstream rng_stream (string(rng_state.begin(), rng_state.end()));
+	rng_stream >> rng.getEngine();
+
+	//2. Genotype graphs
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		g->n_segments = readScalar < unsigned int > (fd);
+		g->n_transitions = readScalar < unsigned int > (fd);
+		readVector(fd, g->ProbMask);
+		readVector(fd, g->ProbStored);
+	}
+	if (G.sparse) readArray(fd, G.arenaSparse.data(), G.arenaSparse.size(), fname);
+	else readArray(fd, G.arenaVariants, G.n_ind * G.vstride, fname);
+	readArray(fd, G.arenaAmbiguous.data(), G.arenaAmbiguous.size(), fname);
+	readArray(fd, G.arenaDiplotypes.data(), G.arenaDiplotypes.size(), fname);
+	readArray(fd, G.arenaLengths.data(), G.arenaLengths.size(), fname);
+
+	//3. Target haplotypes
+	readArray(fd, H.H_opt_hap.bytes, 2UL * H.n_ind * (H.H_opt_hap.n_cols / 8), fname);
+
+	//4. Convergence and PBWT depth of each individual, sized by the options of the current run
+	readArray(fd, freezeSwitches.data(), freezeSwitches.size(), fname);
+	if (readScalar < unsigned long > (fd) != freezeK.size()) vrb.error("Checkpoint [" + fname + "] was written with other --mcmc-freeze settings");
+	for (unsigned long i = 0 ; i < freezeK.size() ; i ++) readVector(fd, freezeK[i]);
+	readArray(fd, depthBlocks.data(), depthBlocks.size(), fname);
+	if (!fd) vrb.error("Truncated checkpoint [" + fname + "]");
+	vrb.bullet("Checkpoint loaded [" + fname + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	return true;
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _MCMC_CHECKPOINT_H
+#define _MCMC_CHECKPOINT_H
+
+#include <utils/otools.h>
+
+#include <containers/genotype_set.h>
+#include <containers/haplotype_set.h>
+
+/*
+ * State of the MCMC between two iterations, written in [dir]/shapeit4.ckpt so that an interrupted run can be resumed
+ * with --resume. It contains the iteration cursor, the state of the random number generator, the genotype graphs as
+ * pruned so far (segments, ambiguous haplotypes, sampled variants), the transition probabilities stored in the main
+ * iterations and the current target haplotypes, as well as the per individual state of --mcmc-freeze and
+ * --pbwt-depth-adaptive (empty when these options are off). The state is copied into memory by save, then written to disk by a
+ * background thread while the next iteration runs; the file is replaced atomically once complete.
+ */
+class mcmc_checkpoint {
+public:
+	//DATA
+	haplotype_set & H;
+	genotype_set & G;
+	vector < float > & freezeSwitches;
+	vector < vector < unsigned int > > & freezeK;
+	vector < unsigned char > & depthBlocks;
+	string fname;
+	string scheme;					//Iteration scheme, a checkpoint only resumes the same scheme
+	vector < char > buffer;			//Snapshot being written
+	pthread_t id_writer;
+	bool writing;
+	string write_error;				//Failure of the writer thread, reported by wait (empty when none)
+	double t_write;					//Time spent writing the last snapshot in the background, in ms
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	mcmc_checkpoint(haplotype_set &, genotype_set &, vector < float > &, vector < vector < unsigned int > > &, vector < unsigned char > &, string dir, string scheme);
+	~mcmc_checkpoint();
+
+	//IO
+	void save(unsigned int, unsigned int, unsigned long);
+	bool load(unsigned int &, unsigned int &, unsigned long &);
+	void write();
+	void wait();
+};
+
+#endif
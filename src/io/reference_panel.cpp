@@ -0,0 +1,225 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/reference_panel.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char panel_magic [8] = { 'S', 'H', 'P', '4', 'R', 'E', 'F', 1 };
+
+template < typename T >
+static void writeBinary(std::ofstream & fd, T value) {
+	fd.write(reinterpret_cast < char * > (&value), sizeof(T));
+}
+
+static void writePadding(std::ofstream & fd, unsigned long align) {
+	unsigned long curr = fd.tellp();
+	for (unsigned long p = curr ; p % align ; p ++) fd.put(0);
+}
+
+reference_panel::reference_panel() {
+	n_samples = n_sites = row_bytes = 0;
+	offset_haps = offset_pos = offset_str = offset_pool = size_pool = offset_names = size_names = 0;
+	fd = -1;
+	meta = NULL;
+	haps = NULL;
+	meta_offset = meta_size = haps_offset = haps_size = 0;
+	pos = NULL;
+	str = NULL;
+	pool = NULL;
+	site_first = site_last = site_cursor = 0;
+}
+
+reference_panel::~reference_panel() {
+	close();
+}
+
+bool reference_panel::isPanel(string fname) {
+	char magic [8];
+	std::ifstream fd (fname.c_str(), std::ios::in | std::ios::binary);
+	if (!fd.is_open() || !fd.read(magic, 8)) return false;
+	return (memcmp(magic, panel_magic, 7) == 0);
+}
+
+void reference_panel::convert(string fvcf, string region, string fpanel, htsThreadPool * tpool) {
+	//1. Open reference VCF/BCF
+	tac.clock();
+	bcf_srs_t * sr =  bcf_sr_init();
+	if (tpool) sr->p = tpool;
+	if (bcf_sr_set_regions(sr, region.c_str(), 0) == -1) vrb.error("Impossible to jump to region [" + region + "] in [" + fvcf + "]");
+	if (!bcf_sr_add_reader(sr, fvcf.c_str())) vrb.error("Problem opening index file for [" + fvcf + "]");
+	bcf_hdr_t * hdr = sr->readers[0].header;
+	n_samples = bcf_hdr_nsamples(hdr);
+	row_bytes = (2 * n_samples + 7) / 8;
+
+	//2. Stream haplotype rows, keep site metadata in a variant table
+	std::ofstream fd_out (fpanel.c_str(), std::ios::out | std::ios::binary);
+	if (!fd_out.is_open()) vrb.error("Impossible to create [" + fpanel + "]");
+	vector < char > header = vector < char > (PANEL_HAPS_OFFSET, 0);
+	fd_out.write(header.data(), PANEL_HAPS_OFFSET);
+	variant_map V;
+	vector < unsigned char > buffer = vector < unsigned char > (row_bytes);
+	int * gt_arr = NULL, ngt_arr = 0;
+	unsigned long n_missing = 0, n_unphased = 0;
+	bcf1_t * line;
+	while (bcf_sr_next_line(sr)) {
+		line = bcf_sr_get_line(sr, 0);
+		if (line->n_allele != 2) continue;
+		bcf_unpack(line, BCF_UN_STR);
+		const char * line_chr = bcf_hdr_id2name(hdr, line->rid);
+		if (V.size() && V.chr(0) != line_chr) vrb.error("Reference panels are converted one chromosome at a time, use --region");
+		int ngt = bcf_get_genotypes(hdr, line, &gt_arr, &ngt_arr);
+		if (ngt != 2 * n_samples) vrb.error("Reference panel requires diploid genotypes at [" + string(line_chr) + ":" + stb.str(line->pos + 1) + "]");
+		std::fill(buffer.begin(), buffer.end(), 0);
+		unsigned int calt = 0;
+		for (int h = 0 ; h < 2 * n_samples ; h ++) {
+			unsigned char a = (bcf_gt_allele(gt_arr[h])==1);
+			buffer[h/8] |= a << (7 - (h%8));
+			calt += a;
+			if (h%2) {
+				n_missing += (gt_arr[h-1] == bcf_gt_missing || gt_arr[h] == bcf_gt_missing);
+				n_unphased += !bcf_gt_is_phased(gt_arr[h]);
+			}
+		}
+		fd_out.write(reinterpret_cast < char * > (buffer.data()), row_bytes);
+		V.push(line_chr, line->pos + 1, line->d.id, line->d.allele[0], line->d.allele[1], 2 * n_samples - calt, calt, 0);
+	}
+	free(gt_arr);
+	n_sites = V.size();
+	if (n_sites == 0) vrb.error("No biallelic variants in [" + fvcf + "] for region [" + region + "]");
+	chr = V.chr(0);
+
+	//3. Metadata after the haplotypes
+	writePadding(fd_out, 8);
+	offset_pos = fd_out.tellp();
+	fd_out.write(reinterpret_cast < const char * > (V.vec_bp.data()), n_sites * sizeof(int));
+	writePadding(fd_out, 8);
+	offset_str = fd_out.tellp();
+	fd_out.write(reinterpret_cast < const char * > (V.vec_str.data()), n_sites * sizeof(unsigned long));
+	offset_pool = fd_out.tellp();
+	size_pool = V.pool.size();
+	fd_out.write(V.pool.data(), size_pool);
+	offset_names = fd_out.tellp();
+	fd_out.write(chr.c_str(), chr.size() + 1);
+	for (int i = 0 ; i < n_samples ; i ++) fd_out.write(hdr->samples[i], strlen(hdr->samples[i]) + 1);
+	size_names = (unsigned long)fd_out.tellp() - offset_names;
+	bcf_sr_destroy(sr);
+
+	//4. Header
+	offset_haps = PANEL_HAPS_OFFSET;
+	fd_out.seekp(0);
+	fd_out.write(panel_magic, 8);
+	writeBinary < unsigned long > (fd_out, n_samples);
+	writeBinary < unsigned long > (fd_out, n_sites);
+	writeBinary < unsigned long > (fd_out, row_bytes);
+	writeBinary < unsigned long > (fd_out, offset_haps);
+	writeBinary < unsigned long > (fd_out, offset_pos);
+	writeBinary < unsigned long > (fd_out, offset_str);
+	writeBinary < unsigned long > (fd_out, offset_pool);
+	writeBinary < unsigned long > (fd_out, size_pool);
+	writeBinary < unsigned long > (fd_out, offset_names);
+	writeBinary < unsigned long > (fd_out, size_names);
+	fd_out.close();
+	if (fd_out.fail()) vrb.error("Non zero status when closing reference panel [" + fpanel + "]");
+	vrb.bullet("Panel conversion [N=" + stb.str(n_samples) + " / L=" + stb.str(n_sites) + " / Reg=" + region + " / Haps=" + stb.str(n_sites * row_bytes * 1.0 / (1024 * 1024), 2) + "MB] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	if (n_missing > 0) vrb.warning(stb.str(n_missing) + " missing genotypes in the reference panel (set to REF)");
+	if (n_unphased > 0) vrb.warning(stb.str(n_unphased) + " unphased genotypes in the reference panel (taken as phased)");
+}
+
+void reference_panel::open(string _fname, string region) {
+	tac.clock();
+	fname = _fname;
+	if ((fd = ::open(fname.c_str(), O_RDONLY)) < 0) vrb.error("Impossible to open reference panel [" + fname + "]");
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < PANEL_HEADER) vrb.error("Truncated reference panel [" + fname + "]");
+
+	//1. Header
+	unsigned long header [(PANEL_HEADER - 8) / 8];
+	char magic [8];
+	if (pread(fd, magic, 8, 0) != 8 || memcmp(magic, panel_magic, 8)) vrb.error("Unsupported reference panel [" + fname + "]");
+	if (pread(fd, header, PANEL_HEADER - 8, 8) != PANEL_HEADER - 8) vrb.error("Truncated reference panel [" + fname + "]");
+	n_samples = header[0]; n_sites = header[1]; row_bytes = header[2];
+	offset_haps = header[3]; offset_pos = header[4]; offset_str = header[5];
+	offset_pool = header[6]; size_pool = header[7]; offset_names = header[8]; size_names = header[9];
+	if (offset_names + size_names > (unsigned long)st.st_size) vrb.error("Truncated reference panel [" + fname + "]");
+
+	//2. Metadata, mapped whole
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	meta_offset = offset_pos - (offset_pos % page);
+	meta_size = offset_names + size_names - meta_offset;
+	meta = (char *)mmap(NULL, meta_size, PROT_READ, MAP_PRIVATE, fd, meta_offset);
+	if (meta == MAP_FAILED) vrb.error("Impossible to map reference panel [" + fname + "]");
+	pos = reinterpret_cast < const int * > (meta + (offset_pos - meta_offset));
+	str = reinterpret_cast < const unsigned long * > (meta + (offset_str - meta_offset));
+	pool = meta + (offset_pool - meta_offset);
+	const char * name = meta + (offset_names - meta_offset);
+	chr = string(name);
+	names.clear();
+	name += chr.size() + 1;
+	for (unsigned long i = 0 ; i < n_samples ; i ++, name += strlen(name) + 1) names.push_back(const_cast < char * > (name));
+
+	//3. Region slicing on the sorted positions
+	vector < string > tokens;
+	string rchr = region, rbounds;
+	size_t colon = region.find(':');
+	if (colon != string::npos) { rchr = region.substr(0, colon); rbounds = region.substr(colon + 1); }
+	if (rchr != chr) vrb.error("Region [" + region + "] is not on the chromosome of reference panel [" + fname + " / " + chr + "]");
+	int rfrom = 0, rto = std::numeric_limits < int >::max();
+	if (rbounds.size()) {
+		stb.split(rbounds, tokens, "-");
+		rfrom = atoi(tokens[0].c_str());
+		if (tokens.size() > 1 && tokens[1].size()) rto = atoi(tokens[1].c_str());
+	}
+	site_first = std::lower_bound(pos, pos + n_sites, rfrom) - pos;
+	site_last = std::upper_bound(pos, pos + n_sites, rto) - pos;
+	site_cursor = site_first;
+
+	//4. Haplotype rows of the region only
+	if (site_last > site_first) {
+		unsigned long begin = offset_haps + site_first * row_bytes, end = offset_haps + site_last * row_bytes;
+		haps_offset = begin - (begin % page);
+		haps_size = end - haps_offset;
+		haps = (unsigned char *)mmap(NULL, haps_size, PROT_READ, MAP_PRIVATE, fd, haps_offset);
+		if (haps == MAP_FAILED) vrb.error("Impossible to map reference panel [" + fname + "]");
+		madvise(haps, haps_size, MADV_SEQUENTIAL);
+	}
+	vrb.bullet("Panel mapping [N=" + stb.str(n_samples) + " / L=" + stb.str(site_last - site_first) + " / Reg=" + region + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+void reference_panel::close() {
+	if (haps && haps != MAP_FAILED) munmap(haps, haps_size);
+	if (meta && meta != MAP_FAILED) munmap(meta, meta_size);
+	if (fd >= 0) ::close(fd);
+	haps = NULL;
+	meta = NULL;
+	fd = -1;
+	names.clear();
+}
+
+long reference_panel::find(int bp, const char * ref_allele, const char * alt_allele) {
+	while (site_cursor < site_last && pos[site_cursor] < bp) site_cursor ++;
+	for (unsigned long l = site_cursor ; l < site_last && pos[l] == bp ; l ++)
+		if (!strcmp(ref(l), ref_allele) && !strcmp(alt(l), alt_allele)) return l;
+	return -1;
+}
@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _REFERENCE_PANEL_H
+#define _REFERENCE_PANEL_H
+
+#include <utils/otools.h>
+
+#include <containers/variant_map.h>
+
+/*
+ * Binary reference panel (shapeit4 convert-reference), all integers little-endian, one chromosome per file:
+ *
+ * [HEADER, padded to PANEL_HAPS_OFFSET bytes]
+ *   char[8]  magic "SHP4REF" + version byte (1)
+ *   uint64   n_samples
+ *   uint64   n_sites
+ *   uint64   row_bytes, bytes per site = ceil(2 * n_samples / 8)
+ *   uint64   offset of the haplotypes (= PANEL_HAPS_OFFSET)
+ *   uint64   offset of the positions
+ *   uint64   offset of the string offsets
+ *   uint64   offset of the string pool, uint64 its size
+ *   uint64   offset of the names, uint64 their size
+ * [HAPLOTYPES]  n_sites rows of row_bytes, in the H_opt_var layout: haplotype h of a site is bit (7 - h%8) of byte h/8
+ *               of its row, unused bits of the last byte are 0
+ * [POSITIONS]   int32[n_sites], sorted, in bp
+ * [STRINGS]     uint64[n_sites], offset in the string pool of the null-terminated ID, followed by REF and ALT
+ * [STRING POOL]
+ * [NAMES]       null-terminated chromosome name, followed by n_samples null-terminated sample names
+ *
+ * Metadata is mapped whole, while only the haplotype rows of the sites falling in the phased region are mapped. Mappings
+ * are aligned on the page size of the running system, the file layout does not depend on it.
+ */
+#define PANEL_HAPS_OFFSET	4096
+#define PANEL_HEADER		88
+
+class reference_panel {
+public:
+	//DATA
+	string fname;
+	string chr;
+	unsigned long n_samples, n_sites, row_bytes;
+	unsigned long offset_haps, offset_pos, offset_str, offset_pool, size_pool, offset_names, size_names;
+	vector < char * > names;
+	int fd;
+	char * meta;					//Mapping of everything after the haplotypes
+	unsigned long meta_offset, meta_size;
+	unsigned char * haps;			//Mapping of the haplotype rows of the region
+	unsigned long haps_offset, haps_size;
+	const int * pos;
+	const unsigned long * str;
+	const char * pool;
+	unsigned long site_first, site_last;	//Sites [site_first, site_last) overlap the region
+	unsigned long site_cursor;				//First site not yet passed by find
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	reference_panel();
+	~reference_panel();
+
+	//IO
+	static bool isPanel(string);
+	void convert(string fvcf, string region, string fpanel, htsThreadPool * pool = NULL);
+	void open(string, string region);
+	void close();
+	long find(int bp, const char * ref, const char * alt);		//Site matching a variant, -1 if absent; variants must be queried by increasing position
+	const unsigned char * row(unsigned long l);
+	const char * ref(unsigned long l);
+	const char * alt(unsigned long l);
+};
+
+inline
+const unsigned char * reference_panel::row(unsigned long l) {
+	return haps + (offset_haps + l * row_bytes - haps_offset);
+}
+
+inline
+const char * reference_panel::ref(unsigned long l) {
+	const char * s = pool + str[l];
+	return s + strlen(s) + 1;
+}
+
+inline
+const char * reference_panel::alt(unsigned long l) {
+	const char * s = ref(l);
+	return s + strlen(s) + 1;
+}
+
+#endif
@@ -21,11 +21,17 @@
 ////////////////////////////////////////////////////////////////////////////////
 #define _DECLARE_TOOLBOX_HERE
 #include <phaser/phaser_header.h>
+#include <converter/converter_header.h>
 
 int main(int argc, char ** argv) {
 	vector < string > args;
-	for (int a = 1 ; a < argc ; a ++) args.push_back(string(argv[a]));
-	phaser().phase(args);
+	if (argc > 1 && string(argv[1]) == "convert-reference") {
+		for (int a = 2 ; a < argc ; a ++) args.push_back(string(argv[a]));
+		converter().convert(args);
+	} else {
+		for (int a = 1 ; a < argc ; a ++) args.push_back(string(argv[a]));
+		phaser().phase(args);
+	}
 	return 0;
 }
 
@@ -29,6 +29,8 @@ haplotype_segment::haplotype_segment(genotype * _G, bitmatrix & _H, vector < uns
 	ambiguous_first = C.start_ambiguous;
 	ambiguous_last = C.stop_ambiguous;
 	transition_first = C.start_transition;
+	curr_code_cursor = 0;
+	curr_code = 0;
 	n_cond_haps = idxH.size();
 	prob1 = vector < double > (HAP_NUMBER * n_cond_haps, 1.0);
 	prob2 = vector < double > (HAP_NUMBER * n_cond_haps, 1.0);
@@ -83,7 +85,8 @@ void haplotype_segment::forward() {
 		curr_rel_locus = curr_abs_locus - locus_first;
 		bool scale = (curr_rel_locus % HAP_SCALE == 0);
 		bool paired = (curr_rel_locus % 2 == 0);
-		bool amb = VAR_GET_AMB(MOD2(curr_abs_locus), G->Variants[DIV2(curr_abs_locus)]);
+		curr_code = G->getCode(curr_abs_locus, curr_code_cursor);
+		bool amb = VAR_GET_AMB(0, curr_code);
 
 		if (amb) paired?AMB2():AMB1();
 		else paired?HOM2():HOM1();
@@ -115,7 +118,8 @@ void haplotype_segment::backward() {
 		curr_rel_locus = curr_abs_locus - locus_first;
 		bool scale = (curr_rel_locus % HAP_SCALE == 0);
 		bool paired = (curr_rel_locus % 2 == 0);
-		bool amb = VAR_GET_AMB(MOD2(curr_abs_locus), G->Variants[DIV2(curr_abs_locus)]);
+		curr_code = G->getCode(curr_abs_locus, curr_code_cursor);
+		bool amb = VAR_GET_AMB(0, curr_code);
 		if (amb) paired?AMB2():AMB1();
 		else paired?HOM2():HOM1();
 		if (curr_abs_locus != locus_last) {
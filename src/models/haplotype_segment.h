@@ -54,6 +54,8 @@ private:
 	int curr_rel_segment_index;
 	int curr_abs_ambiguous;
 	int curr_abs_transition;
+	unsigned int curr_code_cursor;
+	unsigned char curr_code;
 
 	//DYNAMIC ARRAYS
 	double probSumT1;
@@ -104,7 +106,7 @@ public:
 
 inline
 void haplotype_segment::HOM2() {
-	bool ag = VAR_GET_HAP0(MOD2(curr_abs_locus), G->Variants[DIV2(curr_abs_locus)]);
+	bool ag = VAR_GET_HAP0(0, curr_code);
 	for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
 		bool ah = H.get(idxH[k], curr_abs_locus);
 		if (ag != ah) fill(prob2.begin() + i, prob2.begin() + i + HAP_NUMBER, M.ed);
@@ -114,7 +116,7 @@ void haplotype_segment::HOM2() {
 
 inline
 void haplotype_segment::HOM1() {
-	bool ag = VAR_GET_HAP0(MOD2(curr_abs_locus), G->Variants[DIV2(curr_abs_locus)]);
+	bool ag = VAR_GET_HAP0(0, curr_code);
 	for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
 		bool ah = H.get(idxH[k], curr_abs_locus);
 		if (ag != ah) fill(prob1.begin() + i, prob1.begin() + i + HAP_NUMBER, M.ed);
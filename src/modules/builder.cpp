@@ -25,6 +25,7 @@
 
 builder::builder(genotype_set & _G, int n_thread): G(_G) {
 	this->n_thread = n_thread;
+	counting = false;
 	if (n_thread > 1) {
 		i_workers = 0;
 		id_workers = vector < pthread_t > (n_thread);
@@ -46,23 +47,38 @@ void * builder_callback(void * ptr) {
 		pthread_mutex_lock( &B->mutex_workers );
 		int curr_ind_to_process = B->i_workers++;
 		pthread_mutex_unlock( &B->mutex_workers);
-		if (curr_ind_to_process < B->G.n_ind) B->build(curr_ind_to_process);
+		if (curr_ind_to_process < B->G.n_ind) B->counting?B->count(curr_ind_to_process):B->build(curr_ind_to_process);
 		else pthread_exit(NULL);
 	}
 	return NULL;
 }
 
+void builder::count(int ind) {
+	G.vecG[ind]->count();
+}
+
 void builder::build(int ind) {
 	G.vecG[ind]->build();
 }
 
-void builder::build() {
-	tac.clock();
+void builder::run() {
+	i_workers = 0;
 	if (n_thread > 1) {
 		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, builder_callback, static_cast<void *>(this));
 		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
-	} else for (int i = 0 ; i  <  G.n_ind ; i ++) build(i);
+	} else for (int i = 0 ; i  <  G.n_ind ; i ++) counting?count(i):build(i);
+}
+
+void builder::build() {
+	tac.clock();
+	//1. Size all genotype graphs, then carve the segment arenas
+	counting = true;
+	run();
+	G.allocateSegments();
+	//2. Build all genotype graphs in place
+	counting = false;
+	run();
 	long int n_segments = G.numberOfSegments();
-	vrb.bullet("Build genotype graphs [seg=" + stb.str(n_segments) + "] (" + stb.str(tac.rel_time()*0.001, 2) + "s)");
+	vrb.bullet("Build genotype graphs [seg=" + stb.str(n_segments) + " / mem=" + stb.str(G.sizeOfArenas() * 1.0 / (1024 * 1024), 2) + "MB] (" + stb.str(tac.rel_time()*0.001, 2) + "s)");
 }
 
@@ -29,6 +29,7 @@ class builder {
 public:
 	//DATA
 	genotype_set & G;
+	bool counting;			//true when sizing genotype graphs, false when building them
 
 	//MULTI-THREADING
 	int i_workers;
@@ -43,6 +44,8 @@ public:
 	//METHODS
 	void build();
 	void build(int);
+	void count(int);
+	void run();
 };
 
 #endif
@@ -63,6 +63,7 @@ void pbwt_solver::sweep(genotype_set & G) {
 	tac.clock();
 	vector < int > B = vector < int >(n_total_hap, 0);
 	vector < int > E = vector < int >(n_total_hap, 0);
+	vector < unsigned int > C = vector < unsigned int >(n_main_hap/2, 0);
 
 	for (int l = 0 ; l < n_site ; l++) {
 		int idx_next = (l%2 == 1);
@@ -72,8 +73,9 @@ void pbwt_solver::sweep(genotype_set & G) {
 			unsigned int nm = 0, nh = 0;
 			for (int h = 0 ; h < n_total_hap ; h++) Guess[h] = (H.get(l, h)?1:-1);
 			for (int i = 0 ; i < n_main_hap/2 ; i ++) {
-				Mis[i] = VAR_GET_MIS(MOD2(l), G.vecG[i]->Variants[DIV2(l)]);
-				Het[i] = VAR_GET_HET(MOD2(l), G.vecG[i]->Variants[DIV2(l)]);
+				unsigned char code = G.vecG[i]->getCode(l, C[i]);
+				Mis[i] = VAR_GET_MIS(0, code);
+				Het[i] = VAR_GET_HET(0, code);
 				Amb[i] = (Het[i] || Mis[i]);
 				if (Amb[i]) { Guess[2*i+0] = 0; Guess[2*i+1] = 0;}
 				nh+=Het[i];
@@ -50,22 +50,28 @@ void compute_job::free () {
 	vector < double > ().swap(T);
 	vector < coordinates > ().swap(C);
 	vector < vector < unsigned int > > ().swap(Kvec);
+	vector < unsigned int > ().swap(Dvec);
 }
 
 void compute_job::reset() {
 	C.clear();
 	Kvec.clear();
+	Dvec.clear();
 }
 
-void compute_job::make(unsigned int ind, double min_window_size) {
+void compute_job::make(unsigned int ind, double min_window_size, vector < unsigned int > * boundaries, const unsigned char * depths) {
 	unsigned int n_segments_per_window, n_windows;
 	unsigned int n_splits = (unsigned int)round(V.length() * 1.0 / min_window_size);
 	if (!n_splits) n_splits = 1;
 	n_segments_per_window = G.vecG[ind]->n_segments/n_splits;
 
-	//Recursive split into overlaping windows
+	//Recursive split into overlaping windows, or the split given when set
 	vector < unsigned int > output = vector < unsigned int > (2, 0); output[1] = G.vecG[ind]->n_segments -1;
-	if (n_segments_per_window >= 2) split(n_segments_per_window, 0, G.vecG[ind]->n_segments-1, output);
+	if (boundaries && boundaries->size()) output = *boundaries;
+	else {
+		if (n_segments_per_window >= 2) split(n_segments_per_window, 0, G.vecG[ind]->n_segments-1, output);
+		if (boundaries) *boundaries = output;
+	}
 	n_windows = output.size()/2;
 
 	//Map coordinates of each segment
@@ -76,10 +82,10 @@ void compute_job::make(unsigned int ind, double min_window_size) {
 	vector < unsigned int > tra_idx = vector < unsigned int >(G.vecG[ind]->n_segments, 0);
 	vector < unsigned int > tra_siz = vector < unsigned int >(G.vecG[ind]->n_segments, 0);
 	unsigned int prev_dipcounts = 1, curr_dipcounts = 0;
-	for (unsigned int s = 0, a = 0, t = 0, v = 0 ; s < G.vecG[ind]->n_segments ; s ++) {
+	for (unsigned int s = 0, a = 0, t = 0, v = 0, c = 0 ; s < G.vecG[ind]->n_segments ; s ++) {
 		//update a
 		amb_idx[s] = a;
-		for (unsigned int vrel = 0 ; vrel < G.vecG[ind]->Lengths[s] ; vrel ++) amb_siz[s] += VAR_GET_AMB(MOD2(v+vrel), G.vecG[ind]->Variants[DIV2(v+vrel)]);
+		amb_siz[s] = G.vecG[ind]->countAmbiguous(v, v + G.vecG[ind]->Lengths[s], c);
 		a += amb_siz[s];
 		//update v
 		loc_idx[s] = v;
@@ -111,34 +117,57 @@ void compute_job::make(unsigned int ind, double min_window_size) {
 	assert(C.back().stop_locus == G.vecG[ind]->n_variants - 1);
 	assert(C.back().stop_transition == G.vecG[ind]->n_transitions - 1);
 
-	//Update conditional haps
-	int n_state = H.depth;
+	//Depth of each window: all stored neighbours, or the mean depth of the blocks it overlaps when given
+	Dvec = vector < unsigned int > (n_windows, H.depth);
+	if (depths) for (int w = 0 ; w < n_windows ; w ++) {
+		unsigned int b_first = C[w].start_locus / DEPTH_BLOCK, b_last = C[w].stop_locus / DEPTH_BLOCK, sum = 0;
+		for (unsigned int b = b_first ; b <= b_last ; b ++) sum += depths[b];
+		Dvec[w] = min((unsigned int)H.depth, max(1U, (sum + (b_last - b_first + 1) / 2) / (b_last - b_first + 1)));
+	}
+
+	//Update conditional haps: the stored PBWT indexes of each window are located by binary search, then the neighbours
+	//of both haplotypes are read along their contiguous rows (see transposeC2H), skipping neighbours repeated from one index to the next
 	unsigned long addr_offset = H.n_save * (unsigned long)H.n_ind * 2UL;
 	Kvec = vector < vector < unsigned int > > (n_windows);
-	vector < int > phap = vector < int > (2 * H.depth, -1);
-	for (int l = 0, w = 0 ; l < H.abs_indexes.size() ; l ++) {
-		int abs_idx = H.abs_indexes[l];
-		int rel_idx = H.rel_indexes[l];
-		if (abs_idx > C[w].stop_locus) { std::fill(phap.begin(), phap.end(), -1); w++; }
-		bool addToNext = ((w+1)<n_windows && abs_idx>=C[w+1].start_locus);
-		if (rel_idx >= 0) {
-			unsigned long curr_hap0 = 2*ind+0;
-			unsigned long curr_hap1 = 2*ind+1;
-			for (int s = 0 ; s < H.depth ; s ++) {
-				int cond_hap0 = H.save_clusters[s * addr_offset + curr_hap0*H.n_save + rel_idx];
-				int cond_hap1 = H.save_clusters[s * addr_offset + curr_hap1*H.n_save + rel_idx];
-				if (cond_hap0 != phap[2*s+0]) { Kvec[w].push_back(cond_hap0); phap[2*s+0] = cond_hap0; };
-				if (cond_hap1 != phap[2*s+1]) { Kvec[w].push_back(cond_hap1); phap[2*s+1] = cond_hap1; };
-				if (addToNext) { Kvec[w+1].push_back(cond_hap0); Kvec[w+1].push_back(cond_hap1); }
+	for (int w = 0 ; w < n_windows ; w ++) {
+		int r_first = std::lower_bound(H.save_locus.begin(), H.save_locus.end(), C[w].start_locus) - H.save_locus.begin();
+		int r_last = std::upper_bound(H.save_locus.begin(), H.save_locus.end(), C[w].stop_locus) - H.save_locus.begin();
+		for (int s = 0 ; s < Dvec[w] ; s ++) {
+			for (unsigned long h = 2UL*ind ; h < 2UL*ind+2 ; h ++) {
+				const int * row = H.save_clusters.data() + s * addr_offset + h * H.n_save;
+				int prev_hap = -1;
+				for (int r = r_first ; r < r_last ; r ++) if (row[r] != prev_hap) {
+					Kvec[w].push_back(row[r]);
+					prev_hap = row[r];
+				}
 			}
 		}
-	}
-	for (int w = 0 ; w < n_windows; w++) {
 		sort(Kvec[w].begin(), Kvec[w].end());
 		Kvec[w].erase(unique(Kvec[w].begin(), Kvec[w].end()), Kvec[w].end());
 	}
 }
 
+double compute_job::entropy(unsigned int ind, unsigned int w) {
+	//Mean entropy of the transitions at the segment boundaries of window w, each scaled to [0,1] (0: certain, 1: uniform)
+	//Diplotypes come in complementary pairs, so a certain transition still spreads evenly over two of them
+	double sumE = 0.0;
+	unsigned int n_boundaries = 0;
+	unsigned int prev_dipcount = G.vecG[ind]->countDiplotypes(G.vecG[ind]->Diplotypes[C[w].start_segment]);
+	for (unsigned int s = C[w].start_segment + 1, t = C[w].start_transition ; s <= C[w].stop_segment ; s ++) {
+		unsigned int curr_dipcount = G.vecG[ind]->countDiplotypes(G.vecG[ind]->Diplotypes[s]);
+		unsigned int curr_transcount = prev_dipcount * curr_dipcount;
+		if (curr_transcount > 1) {
+			double e = 0.0;
+			for (unsigned int trel = 0 ; trel < curr_transcount ; trel ++) if (T[t+trel] > 0.0) e -= T[t+trel] * log(T[t+trel]);
+			sumE += max(0.0, e - log(2.0)) / log(curr_transcount / 2.0);
+			n_boundaries ++;
+		}
+		t += curr_transcount;
+		prev_dipcount = curr_dipcount;
+	}
+	return n_boundaries?(sumE / n_boundaries):0.0;
+}
+
 void compute_job::maskingTransitions(unsigned int ind, double error_rate) {
 	vector < double > curr_transitions = vector < double > (4096, 0.0);
 	unsigned int prev_dipcount = 1, curr_dipcount = 0, curr_transcount = 0;
@@ -62,6 +62,8 @@ public:
 	}
 };
 
+#define DEPTH_BLOCK	1024		//Variants per block in which the adaptive PBWT depth of an individual is kept
+
 class compute_job {
 public:
 	variant_map & V;
@@ -70,13 +72,16 @@ public:
 	vector < double > T;
 	vector < coordinates > C;
 	vector < vector < unsigned int > > Kvec;
+	vector < unsigned int > Dvec;		//PBWT depth used to build each window of Kvec
+	merge_buffer MB;
 
 	compute_job(variant_map & , genotype_set & , haplotype_set & , unsigned int n_max_transitions);
 	~compute_job();
 
 	void free();
 	void reset();
-	void make(unsigned int, double);
+	void make(unsigned int, double, vector < unsigned int > * boundaries = NULL, const unsigned char * depths = NULL);
+	double entropy(unsigned int, unsigned int);
 	unsigned int size();
 	void maskingTransitions(unsigned int, double);
 };
@@ -40,111 +40,99 @@
 
 #include <objects/genotype/genotype_header.h>
 
-void genotype::build() {
-	//1. Count number of segments
-	unsigned n_unf = 0, n_var = 0, n_sca = 0, n_seg = 0, n_amb = 0;
-	for (unsigned int v = 0 ; v < n_variants ;) {
-		bool f_sca = VAR_GET_SCA(MOD2(v),Variants[DIV2(v)]);
-		bool f_het = VAR_GET_HET(MOD2(v),Variants[DIV2(v)]);
-		bool f_mis = VAR_GET_MIS(MOD2(v),Variants[DIV2(v)]);
+/*
+ * Splits the variants into segments carrying at most 3 unfolded ambiguous variants (2 when scaffolded variants are
+ * present) and at most 65535 variants. Only ambiguous variants are visited, so that the cost scales with the number of
+ * het/missing/scaffolded calls in the sparse encoding. Segment lengths are written into L when not NULL.
+ */
+void genotype::segment(unsigned short * L) {
+	const unsigned int max_length = std::numeric_limits< unsigned short >::max();
+	unsigned int n_unf = 0, n_sca = 0, n_seg = 0, n_amb = 0, seg_start = 0, c = 0;
+	for (unsigned int v = nextAmbiguous(0, c) ; v < n_variants ; v = nextAmbiguous(v + 1, c)) {
+		unsigned char code = getCode(v, c);
+		bool f_sca = VAR_GET_SCA(0, code);
+		bool f_unf = VAR_GET_HET(0, code) || VAR_GET_MIS(0, code);
 
-		unsigned int predicted_unfold = n_unf + (f_het||f_mis) + (n_sca||f_sca);
-		if (predicted_unfold == 4 || (n_var == std::numeric_limits< unsigned short >::max())) {
+		//1. Cut segments reaching the maximum length in between ambiguous variants
+		while (v - seg_start >= max_length) {
+			if (L) L[n_seg] = max_length;
+			seg_start += max_length;
 			n_unf = 0;
 			n_sca = 0;
-			n_var = 0;
 			n_seg ++;
-		} else {
-			n_unf += (f_het||f_mis);
-			n_sca += f_sca;
-			n_amb += (f_het||f_mis||f_sca);
-			n_var ++;
-			v++;
 		}
-	}
-	n_segments = n_seg + 1;
-	n_ambiguous = n_amb;
 
-	//2. Build Segments
-	n_unf = 0, n_var = 0, n_sca = 0, n_seg = 0, n_amb = 0;
-	Lengths = vector < unsigned short > (n_segments, 0U);
-	for (unsigned int v = 0 ; v < n_variants ;) {
-		bool f_sca = VAR_GET_SCA(MOD2(v),Variants[DIV2(v)]);
-		bool f_het = VAR_GET_HET(MOD2(v),Variants[DIV2(v)]);
-		bool f_mis = VAR_GET_MIS(MOD2(v),Variants[DIV2(v)]);
-
-		unsigned int predicted_unfold = n_unf + (f_het||f_mis) + (n_sca||f_sca);
-		if (predicted_unfold == 4 || (n_var == std::numeric_limits< unsigned short >::max())) {
-			Lengths[n_seg] = n_var;
+		//2. Cut segment when it can no longer be unfolded
+		unsigned int predicted_unfold = n_unf + f_unf + (n_sca||f_sca);
+		if (predicted_unfold == 4) {
+			if (L) L[n_seg] = v - seg_start;
+			seg_start = v;
 			n_unf = 0;
 			n_sca = 0;
-			n_var = 0;
 			n_seg ++;
-		} else {
-			n_unf += (f_het||f_mis);
-			n_sca += f_sca;
-			n_amb += (f_het||f_mis||f_sca);
-			n_var ++;
-			v++;
 		}
+		n_unf += f_unf;
+		n_sca += f_sca;
+		n_amb ++;
+	}
+	while (n_variants - seg_start > max_length) {
+		if (L) L[n_seg] = max_length;
+		seg_start += max_length;
+		n_seg ++;
 	}
-	Lengths[n_seg] = n_var;
+	if (L) L[n_seg] = n_variants - seg_start;
+	n_segments = n_seg + 1;
+	n_ambiguous = n_amb;
+}
 
-	//3. Build Ambiguous
-	Ambiguous = vector < unsigned char >(n_ambiguous, 0U);
-	vector < unsigned char > orderedSegments = vector < unsigned char >(n_segments, 0);
-	for (unsigned int s = 0, a0 = 0, a1 = 0, a2 = 0, vabs = 0 ; s < n_segments ; s ++) {
-		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) {
-			bool f_sca = VAR_GET_SCA(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			bool f_het = VAR_GET_HET(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			bool f_mis = VAR_GET_MIS(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			if (f_sca) {
+void genotype::count() {
+	//1. Count number of segments
+	segment(NULL);
+}
+
+void genotype::build() {
+	//2. Build Segments (Lengths, Ambiguous and Diplotypes point to arenas sized from count())
+	segment(Lengths);
+
+	//3. Build Ambiguous and Diplotypes
+	std::fill(Ambiguous, Ambiguous + n_ambiguous, 0U);
+	for (unsigned int s = 0, a = 0, vabs = 0, c = 0 ; s < n_segments ; s ++) {
+		unsigned int vend = vabs + Lengths[s], n_amb = 0;
+		bool scaffolded = false;
+		//3.1. Scaffolded variants carry their phased alleles on all haplotypes
+		for (unsigned int v = nextAmbiguous(vabs, c) ; v < vend ; v = nextAmbiguous(v + 1, c), n_amb ++) {
+			unsigned char code = getCode(v, c);
+			if (VAR_GET_SCA(0, code)) {
 				for (unsigned int h = 0 ; h < HAP_NUMBER ; h ++) {
-					bool allele = (h%2)?VAR_GET_HAP1(MOD2(vabs+vrel), Variants[DIV2(vabs+vrel)]):VAR_GET_HAP0(MOD2(vabs+vrel), Variants[DIV2(vabs+vrel)]);
-					if (allele) HAP_SET(Ambiguous[a0], h);
+					bool allele = (h%2)?VAR_GET_HAP1(0, code):VAR_GET_HAP0(0, code);
+					if (allele) HAP_SET(Ambiguous[a+n_amb], h);
 				}
-				orderedSegments[s] = 1;
+				scaffolded = true;
 			}
-			a0 += (f_sca + f_het + f_mis);
 		}
-		unsigned int n_unf = orderedSegments[s];
-		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) {
-			bool f_sca = VAR_GET_SCA(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			bool f_het = VAR_GET_HET(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			bool f_mis = VAR_GET_MIS(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			if (f_het||f_mis) {
-				for (unsigned int h = 0 ; h < HAP_NUMBER ; h ++) {
-					bool allele = ((h>>n_unf)%2);
-					if (allele) HAP_SET(Ambiguous[a1], h);
-				}
-				n_unf++;
+		//3.2. Hets and missing are unfolded over the haplotypes, hets constrain the possible diplotypes
+		unsigned int n_unf = scaffolded;
+		Diplotypes[s] = n_unf?MASK_SCAF:MASK_INIT;
+		for (unsigned int v = nextAmbiguous(vabs, c), arel = 0 ; v < vend ; v = nextAmbiguous(v + 1, c), arel ++) {
+			unsigned char code = getCode(v, c);
+			if (VAR_GET_SCA(0, code)) continue;
+			for (unsigned int h = 0 ; h < HAP_NUMBER ; h ++) {
+				bool allele = ((h>>n_unf)%2);
+				if (allele) HAP_SET(Ambiguous[a+arel], h);
 			}
-			a1 += (f_sca + f_het + f_mis);
-		}
-		vabs += Lengths[s];
-	}
-
-	//4. Build Diplotypes
-	Diplotypes = vector < unsigned long > (n_segments);
-	for (unsigned int s = 0, vabs = 0, a = 0 ; s < n_segments ; s ++) {
-		unsigned int n_unf = orderedSegments[s];
-		Diplotypes[s]=n_unf?MASK_SCAF:MASK_INIT;
-		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) {
-			bool f_het = VAR_GET_HET(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			bool f_mis = VAR_GET_MIS(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-			if (f_het) {
+			if (VAR_GET_HET(0, code)) {
 				switch (n_unf) {
 				case 0: Diplotypes[s] &= MASK_UNF0; break;
 				case 1: Diplotypes[s] &= MASK_UNF1; break;
 				case 2: Diplotypes[s] &= MASK_UNF2; break;
 				}
 			}
-			n_unf += (f_het||f_mis);
+			n_unf++;
 		}
-		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) a+=VAR_GET_AMB(MOD2(vabs+vrel),Variants[DIV2(vabs+vrel)]);
-		vabs += Lengths[s];
+		a += n_amb;
+		vabs = vend;
 	}
 
-	//5. Count transitions
+	//4. Count transitions
 	n_transitions = countTransitions();
 }
@@ -55,6 +55,13 @@
 #define VAR_SET_HAP1(e,v)	((v)|=(8<<((e)<<2)))
 #define VAR_CLR_HAP1(e,v)	((e)?((v)&=127):((v)&=247))
 
+// SPARSE ENCODING: 28 bits for the variant index, 4 bits for the variant code (same layout as a VAR_* nibble with e=0)
+#define SPA_SITE(s)			((s)>>4)
+#define SPA_CODE(s)			((s)&15U)
+#define SPA_MAKE(v,c)		(((v)<<4)|(c))
+#define SPA_MAX_SITE		(1U<<28)
+#define SPA_SEEK_STEPS		8
+
 #define PS_ALLOC_CHUNK	32
 
 struct phase_set {
@@ -68,10 +75,42 @@ struct phase_set {
 	}
 };
 
+#define MAX_TRANS	(HAP_NUMBER * HAP_NUMBER * HAP_NUMBER * HAP_NUMBER)
+
+class Transition {
+public:
+	double prob;
+	unsigned int idx;
+	Transition() { prob = 0.0; idx = 0;}
+	~Transition() {}
+	bool operator < (const Transition & t) const { return (prob > t.prob) || (prob == t.prob && idx < t.idx); }
+};
+
+class TransStatistics {
+public:
+	double entropy;
+	unsigned int idx;
+	bool merged;
+	TransStatistics() {entropy = 1000; idx = -1; merged = false; }
+	~TransStatistics() {};
+	bool operator < (const TransStatistics & s) const { return entropy < s.entropy; }
+};
+
+//Scratch space for mapMerges/performMerges, allocated once per thread and reused across individuals
+class merge_buffer {
+public:
+	vector < Transition > vecTransitions;			// Transitions of the current segment boundary, partially sorted
+	vector < TransStatistics > vecTransStatistics;	// Statistics of all segment boundaries
+	vector < bool > flagMerges;						// Segment boundaries to be merged
+
+	merge_buffer() { vecTransitions = vector < Transition > (MAX_TRANS); }
+	~merge_buffer() {}
+};
+
 class genotype {
 public:
 	// INTERNAL DATA
-	string name;
+	const char * name;					// Sample name (view into the names arena of genotype_set)
 	unsigned int index;					// Index in containers
 	unsigned int n_segments;			// Number of segments
 	unsigned int n_variants;			// Number of variants	(to iterate over Variants)
@@ -80,16 +119,17 @@ public:
 	unsigned int n_masks;				// Number of masked transitions (either 0 or n_transitions)
 	unsigned char curr_dipcodes [64];	// List of diplotypes in a given segment
 
-	// VARIANT / HAPLOTYPE / DIPLOTYPE DATA
-	vector < unsigned char > Variants;		// 0.5 byte per variant
-	vector < unsigned char > Ambiguous;		// 1 byte per ambiguous variant
-	vector < unsigned long > Diplotypes;	// 8 bytes per segment
-	vector < unsigned short > Lengths;		// 2 bytes per segment
+	// VARIANT / HAPLOTYPE / DIPLOTYPE DATA (views into the cohort arenas of genotype_set)
+	unsigned char * Variants;				// 0.5 byte per variant (dense encoding, NULL when sparse)
+	unsigned int * Sparse;					// 4 bytes per non hom-ref or ambiguous variant, sorted (sparse encoding, NULL when dense)
+	unsigned int n_sparse;					// Number of entries in Sparse
+	unsigned char * Ambiguous;				// 1 byte per ambiguous variant
+	unsigned long * Diplotypes;				// 8 bytes per segment
+	unsigned short * Lengths;				// 2 bytes per segment
 
 	//PHASE PROBS
-	vector < bool > ProbMask;
-	vector < float > ProbStored;
-	//vector < float > StoredProbs;
+	vector < unsigned long > ProbMask;		// 1 bit per transition, set when retained at the first storage (64 transitions per word)
+	vector < float > ProbStored;			// 4 bytes per retained transition, packed in transition order
 
 	// PHASE SETS
 	vector < phase_set > PhaseSets;				// Phase set memberships for the ambiguous genotypes (hets, missing, scaffold, etc ...)
@@ -99,16 +139,23 @@ public:
 	genotype(unsigned int);
 	~genotype();
 	void free();
-	void make(vector < unsigned char > &);
+	unsigned int make(vector < unsigned char > &);
+	void segment(unsigned short *);
+	void count();
 	void build();
-	void sample(vector < double > &);
+	unsigned int sample(vector < double > &);
 	void solve();
-	void mapMerges(vector < double > &, double , vector < bool > &);
-	void performMerges(vector < double > &, vector < bool > &);
+	void mapMerges(vector < double > &, double , merge_buffer &);
+	void performMerges(vector < double > &, merge_buffer &);
 	void mask();
 	void store(vector < double > &);
 
 	//INLINES
+	unsigned int seek(unsigned int, unsigned int);
+	unsigned char getCode(unsigned int, unsigned int &);
+	void setCode(unsigned int, unsigned int &, unsigned char);
+	unsigned int nextAmbiguous(unsigned int, unsigned int &);
+	unsigned int countAmbiguous(unsigned int, unsigned int, unsigned int &);
 	unsigned int countDiplotypes(unsigned long);
 	void makeDiplotypes(unsigned long);
 	unsigned int countTransitions();
@@ -121,6 +168,59 @@ void genotype::pushPS(bool _a0, bool _a1, int _ps) {
 	PhaseSets.emplace_back(_ps, _a0, _a1);
 }
 
+/*
+ * Variant codes are read and written the same way in both encodings; the cursor c is an index in Sparse that makes
+ * sequential scans (forward or backward) constant time in the sparse encoding and is ignored in the dense one.
+ */
+inline
+unsigned int genotype::seek(unsigned int v, unsigned int c) {
+	if (c > n_sparse) c = n_sparse;
+	for (int step = 0 ; step < SPA_SEEK_STEPS ; step ++) {
+		if (c < n_sparse && SPA_SITE(Sparse[c]) < v) c++;
+		else if (c > 0 && SPA_SITE(Sparse[c-1]) >= v) c--;
+		else return c;
+	}
+	return std::lower_bound(Sparse, Sparse + n_sparse, SPA_MAKE(v, 0U)) - Sparse;
+}
+
+inline
+unsigned char genotype::getCode(unsigned int v, unsigned int & c) {
+	if (!Sparse) return (Variants[DIV2(v)] >> (MOD2(v) << 2)) & 15U;
+	c = seek(v, c);
+	return (c < n_sparse && SPA_SITE(Sparse[c]) == v)?SPA_CODE(Sparse[c]):0;
+}
+
+inline
+void genotype::setCode(unsigned int v, unsigned int & c, unsigned char code) {
+	if (!Sparse) Variants[DIV2(v)] = (Variants[DIV2(v)] & (MOD2(v)?0x0F:0xF0)) | (code << (MOD2(v) << 2));
+	else {
+		c = seek(v, c);
+		if (c < n_sparse && SPA_SITE(Sparse[c]) == v) Sparse[c] = SPA_MAKE(v, code);
+		else assert(code == 0);			// hom-ref variants are not stored
+	}
+}
+
+inline
+unsigned int genotype::nextAmbiguous(unsigned int v, unsigned int & c) {
+	if (!Sparse) {
+		while (v < n_variants) {
+			if (!MOD2(v) && !(Variants[DIV2(v)] & 0x33)) v += 2;
+			else if (VAR_GET_AMB(MOD2(v), Variants[DIV2(v)])) return v;
+			else v ++;
+		}
+		return n_variants;
+	}
+	for (c = seek(v, c) ; c < n_sparse ; c ++) if (VAR_GET_AMB(0, Sparse[c])) return SPA_SITE(Sparse[c]);
+	return n_variants;
+}
+
+inline
+unsigned int genotype::countAmbiguous(unsigned int from, unsigned int to, unsigned int & c) {
+	unsigned int n = 0;
+	for (unsigned int v = nextAmbiguous(from, c) ; v < to ; v = nextAmbiguous(v + 1, c)) n ++;
+	return n;
+}
+
 inline
 unsigned int genotype::countDiplotypes(unsigned long _dip) {
 	unsigned int c = 0;
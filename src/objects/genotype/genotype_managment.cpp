@@ -26,8 +26,16 @@ genotype::genotype(unsigned int _index) {
 	n_segments = 0;
 	n_variants = 0;
 	n_ambiguous = 0;
+	n_transitions = 0;
+	n_masks = 0;
 	std::fill(curr_dipcodes, curr_dipcodes + 64, 0);
-	this->name = "";
+	name = "";
+	Variants = NULL;
+	Sparse = NULL;
+	n_sparse = 0;
+	Ambiguous = NULL;
+	Diplotypes = NULL;
+	Lengths = NULL;
 }
 
 genotype::~genotype() {
@@ -37,22 +45,35 @@ genotype::~genotype() {
 void genotype::free() {
 	std::fill(curr_dipcodes, curr_dipcodes + 64, 0);
 	name = "";
-	vector < unsigned char > ().swap(Variants);
-	vector < unsigned char > ().swap(Ambiguous);
-	vector < unsigned long > ().swap(Diplotypes);
-	vector < unsigned short > ().swap(Lengths);
+	Variants = NULL;
+	Sparse = NULL;
+	n_sparse = 0;
+	Ambiguous = NULL;
+	Diplotypes = NULL;
+	Lengths = NULL;
+	vector < unsigned long > ().swap(ProbMask);
+	vector < float > ().swap(ProbStored);
 }
 
-void genotype::make(vector < unsigned char > & DipSampled) {
-	for (unsigned int s = 0, vabs = 0, a = 0 ; s < n_segments ; s ++) {
+unsigned int genotype::make(vector < unsigned char > & DipSampled) {
+	//Also counts the switches between the previous haplotypes and the new ones along the het variants
+	unsigned int n_switches = 0, prev_orient = 2;
+	for (unsigned int s = 0, vabs = 0, a = 0, c = 0 ; s < n_segments ; s ++) {
 		unsigned char hap0 = DIP_HAP0(DipSampled[s]);
 		unsigned char hap1 = DIP_HAP1(DipSampled[s]);
-		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel++, vabs++) {
-			if (VAR_GET_AMB(MOD2(vabs), Variants[DIV2(vabs)])) {
-				HAP_GET(Ambiguous[a], hap0)?VAR_SET_HAP0(MOD2(vabs),Variants[DIV2(vabs)]):VAR_CLR_HAP0(MOD2(vabs),Variants[DIV2(vabs)]);
-				HAP_GET(Ambiguous[a], hap1)?VAR_SET_HAP1(MOD2(vabs),Variants[DIV2(vabs)]):VAR_CLR_HAP1(MOD2(vabs),Variants[DIV2(vabs)]);
-				a++;
+		for (unsigned int v = nextAmbiguous(vabs, c) ; v < vabs + Lengths[s] ; v = nextAmbiguous(v + 1, c), a ++) {
+			unsigned char code = getCode(v, c);
+			bool prev_hap0 = VAR_GET_HAP0(0, code);
+			HAP_GET(Ambiguous[a], hap0)?VAR_SET_HAP0(0, code):VAR_CLR_HAP0(0, code);
+			HAP_GET(Ambiguous[a], hap1)?VAR_SET_HAP1(0, code):VAR_CLR_HAP1(0, code);
+			setCode(v, c, code);
+			if (VAR_GET_HET(0, code)) {
+				unsigned int orient = (prev_hap0 == VAR_GET_HAP0(0, code));
+				n_switches += (prev_orient < 2 && orient != prev_orient);
+				prev_orient = orient;
 			}
 		}
+		vabs += Lengths[s];
 	}
+	return n_switches;
 }
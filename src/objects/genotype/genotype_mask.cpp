@@ -31,7 +31,7 @@ void genotype::mask() {
 		ProbabilityMask = vector < bool > (n_transitions, true);
 		// Iterates over segments
 		unsigned char prev_dipcodes [64];
-		unsigned int prev_dipcount = 1, curr_dipcount = 0, n_curr_trans = 0, n_curr_amb = 0;
+		unsigned int prev_dipcount = 1, curr_dipcount = 0, n_curr_trans = 0, n_curr_amb = 0, c = 0;
 		for (unsigned int s = 0, a = 0, v = 0, t = 0 ; s < n_segments ; s ++) {
 
 			if (s == 0) {
@@ -39,28 +39,25 @@ void genotype::mask() {
 				curr_dipcount = countDiplotypes(Diplotypes[s]);
 				makeDiplotypes(Diplotypes[s]);
 				n_curr_trans = curr_dipcount * prev_dipcount;
-				for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) n_curr_amb += (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)]));
+				n_curr_amb += countAmbiguous(v, v + Lengths[s], c);
 
 				// Build haplotype blocks from PS informations
 				map < int, vector < char > > HapBlocks;
-				for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths[s] ; vrel ++) {
-					if (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)])) {
-						unsigned int ps = PhaseSets[a+arel].ps;
-						if (ps) {
-							bool allele0 = PhaseSets[a+arel].a0;
-							bool allele1 = PhaseSets[a+arel].a1;
-							map < int, vector < char > >::iterator it = HapBlocks.find(ps);
-							if (it != HapBlocks.end()) {
-								it->second[2*arel+0] = allele0;
-								it->second[2*arel+1] = allele1;
-							} else {
-								vector < char > newHapBlock = vector < char > (2*n_curr_amb, -1);
-								newHapBlock[2*arel+0] = allele0;
-								newHapBlock[2*arel+1] = allele1;
-								HapBlocks.insert(pair < int, vector < char > > (ps, newHapBlock));
-							}
+				for (unsigned int vamb = nextAmbiguous(v, c), arel = 0 ; vamb < v + Lengths[s] ; vamb = nextAmbiguous(vamb + 1, c), arel ++) {
+					unsigned int ps = PhaseSets[a+arel].ps;
+					if (ps) {
+						bool allele0 = PhaseSets[a+arel].a0;
+						bool allele1 = PhaseSets[a+arel].a1;
+						map < int, vector < char > >::iterator it = HapBlocks.find(ps);
+						if (it != HapBlocks.end()) {
+							it->second[2*arel+0] = allele0;
+							it->second[2*arel+1] = allele1;
+						} else {
+							vector < char > newHapBlock = vector < char > (2*n_curr_amb, -1);
+							newHapBlock[2*arel+0] = allele0;
+							newHapBlock[2*arel+1] = allele1;
+							HapBlocks.insert(pair < int, vector < char > > (ps, newHapBlock));
 						}
-						arel ++;
 					}
 				}
 /*
@@ -77,11 +74,8 @@ void genotype::mask() {
 				for (int trel = 0 ; trel < n_curr_trans ; trel ++) {
 					unsigned int curr_dip = curr_dipcodes[trel];
 					unsigned int curr_h0 = DIP_HAP0(curr_dip);
-					for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths[s] ; vrel ++) {
-						if (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)])) {
-							haplotype[arel] = HAP_GET(Ambiguous[a+arel], curr_h0);
-							arel ++;
-						}
+					for (unsigned int vamb = nextAmbiguous(v, c), arel = 0 ; vamb < v + Lengths[s] ; vamb = nextAmbiguous(vamb + 1, c), arel ++) {
+						haplotype[arel] = HAP_GET(Ambiguous[a+arel], curr_h0);
 					}
 					for (map < int , vector < char > > :: iterator it = HapBlocks.begin() ; it != HapBlocks.end() ; ++it) {
 						assert(it->second.size() == 2 * haplotype.size());
@@ -111,28 +105,25 @@ void genotype::mask() {
 				curr_dipcount = countDiplotypes(Diplotypes[s]);
 				makeDiplotypes(Diplotypes[s]);
 				n_curr_trans = curr_dipcount * prev_dipcount;
-				for (unsigned int vrel = 0 ; vrel < Lengths[s-1] + Lengths[s] ; vrel ++) n_curr_amb += (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)]));
+				n_curr_amb += countAmbiguous(v, v + Lengths[s-1] + Lengths[s], c);
 
 				// Build haplotype blocks from PS informations
 				map < int, vector < char > > HapBlocks;
-				for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths[s-1] + Lengths[s] ; vrel ++) {
-					if (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)])) {
-						unsigned int ps = PhaseSets[a+arel].ps;
-						if (ps) {
-							bool allele0 = PhaseSets[a+arel].a0;
-							bool allele1 = PhaseSets[a+arel].a1;
-							map < int, vector < char > >::iterator it = HapBlocks.find(ps);
-							if (it != HapBlocks.end()) {
-								it->second[2*arel+0] = allele0;
-								it->second[2*arel+1] = allele1;
-							} else {
-								vector < char > newHapBlock = vector < char > (2*n_curr_amb, -1);
-								newHapBlock[2*arel+0] = allele0;
-								newHapBlock[2*arel+1] = allele1;
-								HapBlocks.insert(pair < int, vector < char > > (ps, newHapBlock));
-							}
+				for (unsigned int vamb = nextAmbiguous(v, c), arel = 0 ; vamb < v + Lengths[s-1] + Lengths[s] ; vamb = nextAmbiguous(vamb + 1, c), arel ++) {
+					unsigned int ps = PhaseSets[a+arel].ps;
+					if (ps) {
+						bool allele0 = PhaseSets[a+arel].a0;
+						bool allele1 = PhaseSets[a+arel].a1;
+						map < int, vector < char > >::iterator it = HapBlocks.find(ps);
+						if (it != HapBlocks.end()) {
+							it->second[2*arel+0] = allele0;
+							it->second[2*arel+1] = allele1;
+						} else {
+							vector < char > newHapBlock = vector < char > (2*n_curr_amb, -1);
+							newHapBlock[2*arel+0] = allele0;
+							newHapBlock[2*arel+1] = allele1;
+							HapBlocks.insert(pair < int, vector < char > > (ps, newHapBlock));
 						}
-						arel ++;
 					}
 				}
 /*
@@ -151,11 +142,9 @@ void genotype::mask() {
 					unsigned int next_dip = curr_dipcodes[trel%curr_dipcount];
 					unsigned int prev_h0 = DIP_HAP0(prev_dip);
 					unsigned int next_h0 = DIP_HAP0(next_dip);
-					for (unsigned int vrel = 0, arel = 0 ; vrel < (Lengths[s-1]+Lengths[s]) ; vrel ++) {
-						if (VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)])) {
-							haplotype[arel] = HAP_GET(Ambiguous[a+arel], (vrel<Lengths[s-1])?prev_h0:next_h0);
-							arel ++;
-						}
+					for (unsigned int vamb = nextAmbiguous(v, c), arel = 0 ; vamb < v + Lengths[s-1]+Lengths[s] ; vamb = nextAmbiguous(vamb + 1, c), arel ++) {
+						unsigned int vrel = vamb - v;
+						haplotype[arel] = HAP_GET(Ambiguous[a+arel], (vrel<Lengths[s-1])?prev_h0:next_h0);
 					}
 					for (map < int , vector < char > > :: iterator it = HapBlocks.begin() ; it != HapBlocks.end() ; ++it) {
 						assert(it->second.size() == 2 * haplotype.size());
@@ -174,7 +163,7 @@ void genotype::mask() {
 				cout << name << "\t" << s << "\t" << HapBlocks.size() << "\t" << prop << "\t" << prop * 1.0 / n_curr_trans << endl;
 */
 				// Update a, v and t cursors
-				for (unsigned int vrel = 0 ; vrel < Lengths[s-1] ; vrel ++) a += VAR_GET_AMB(MOD2(v+vrel), Variants[DIV2(v+vrel)]);
+				a += countAmbiguous(v, v + Lengths[s-1], c);
 				v += Lengths[s-1];
 				t += n_curr_trans;
 				std::copy(curr_dipcodes, curr_dipcodes + curr_dipcount, prev_dipcodes);
@@ -22,29 +22,19 @@
 #include <objects/genotype/genotype_header.h>
 
 #define MAX_AMB	32
+#define SORT_STEP	16
 
-class Transition {
-public:
-	double prob;
-	unsigned int idx;
-	Transition() { prob = 0.0; idx = 0;}
-	~Transition() {}
-	bool operator < (const Transition & t) const { return prob > t.prob; }
-};
-
-class TransStatistics {
-public:
-	double entropy;
-	unsigned int idx;
-	bool merged;
-	TransStatistics() {entropy = 1000; idx = -1; merged = false; }
-	~TransStatistics() {};
-	bool operator < (const TransStatistics & s) const { return entropy < s.entropy; }
-};
+//Grows the sorted prefix [0, n_sorted) of the n first transitions; only the transitions actually walked get sorted
+static inline void extendSortedTransitions(vector < Transition > & vecTransitions, unsigned int & n_sorted, unsigned int n) {
+	unsigned int n_target = min(n, max(n_sorted * 2, (unsigned int)SORT_STEP));
+	std::partial_sort(vecTransitions.begin() + n_sorted, vecTransitions.begin() + n_target, vecTransitions.begin() + n);
+	n_sorted = n_target;
+}
 
-void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass, vector < bool > & flagMerges) {
-	vector < TransStatistics > vecTransStatistics = vector < TransStatistics > (n_segments - 1);
-	vector < Transition > vecTransitions = vector < Transition > (4096);
+void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass, merge_buffer & MB) {
+	vector < TransStatistics > & vecTransStatistics = MB.vecTransStatistics;
+	vector < Transition > & vecTransitions = MB.vecTransitions;
+	vecTransStatistics.resize(n_segments - 1);
 
 	//Step0: initialize cursors
 	unsigned int prev_dipcount = countDiplotypes(Diplotypes[0]);
@@ -54,7 +44,7 @@ void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass
 	std::copy(curr_dipcodes, curr_dipcodes+curr_dipcount, prev_dipcodes);
 	unsigned int toffset = prev_dipcount;
 	unsigned int n_curr_transitions = 0;
-	unsigned int aoffset = 0, voffset = 0;
+	unsigned int aoffset = 0, voffset = 0, c = 0;
 
 	for (int s = 1 ; s < n_segments ; s++) {
 		//Step1: update cursors (1)
@@ -70,77 +60,65 @@ void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass
 		//Step3: check number of variants in merged segment
 		unsigned int segment_length = Lengths[s-1] + Lengths[s];
 		if (segment_length < std::numeric_limits< unsigned short >::max()) {
-			unsigned int n_ambiguous_merged = 0;
-			for (unsigned int vrel = 0, arel = 0 ; vrel < (Lengths[s-1]+Lengths[s]) ; vrel ++)
-				if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)]))
-					n_ambiguous_merged++;
+			unsigned int n_ambiguous_merged = countAmbiguous(voffset, voffset + segment_length, c);
 			//Step4: check number of ambiguous variants in merged segment
 			if (n_ambiguous_merged <= MAX_AMB) {
-				//Step5: sort transitions by decreasing order
-				for (int t = 0 ; t < n_curr_transitions ; t ++) {
-					vecTransitions[t].prob = currProbs[toffset + t];
-					vecTransitions[t].idx = t;
-				}
-				sort(vecTransitions.begin(), vecTransitions.begin() + n_curr_transitions);
-				//Step6: compute transition entropy
+				//Step5: load transitions and compute transition entropy (order independent)
 				vecTransStatistics[s-1].entropy = 0.0;
 				for (int t = 0 ; t < n_curr_transitions ; t ++) {
-					double cProb = vecTransitions[t].prob;
+					double cProb = currProbs[toffset + t];
 					double lProb = -1.0 * ((cProb==0.0)?0:log10(cProb));
 					vecTransStatistics[s-1].entropy += cProb * lProb;
+					vecTransitions[t].prob = cProb;
+					vecTransitions[t].idx = t;
 				}
-				//Step7: check that 8 haplotypes capture lots of the cumulative probability mass
+				//Step6: check that 8 haplotypes capture lots of the cumulative probability mass, walking transitions by decreasing probability
 				double cumSumProbs = 0.0;
-				vector < int > Mhaps = vector < int >(HAP_NUMBER * HAP_NUMBER, -1);
-				for (int t = 0, n_haps = 0 ; t < n_curr_transitions ; t ++) {
+				int Mhaps [HAP_NUMBER * HAP_NUMBER];
+				std::fill(Mhaps, Mhaps + HAP_NUMBER * HAP_NUMBER, -1);
+				unsigned int n_sorted = 0;
+				for (int t = 0, n_haps = 0 ; t < n_curr_transitions && n_haps <= HAP_NUMBER && !vecTransStatistics[s-1].merged ; t ++) {
+					if (t == n_sorted) extendSortedTransitions(vecTransitions, n_sorted, n_curr_transitions);
 					cumSumProbs += vecTransitions[t].prob;
 					unsigned int prev_dip = prev_dipcodes[vecTransitions[t].idx/curr_dipcount];
 					unsigned int next_dip = curr_dipcodes[vecTransitions[t].idx%curr_dipcount];
-					unsigned int prev_h0 = DIP_HAP0(prev_dip);
-					unsigned int prev_h1 = DIP_HAP1(prev_dip);
-					unsigned int next_h0 = DIP_HAP0(next_dip);
-					unsigned int next_h1 = DIP_HAP1(next_dip);
-					unsigned int merged_h0 = prev_h0 * HAP_NUMBER + next_h0;
-					unsigned int merged_h1 = prev_h1 * HAP_NUMBER + next_h1;
+					unsigned int merged_h0 = DIP_HAP0(prev_dip) * HAP_NUMBER + DIP_HAP0(next_dip);
+					unsigned int merged_h1 = DIP_HAP1(prev_dip) * HAP_NUMBER + DIP_HAP1(next_dip);
 					bool new_h0 = (Mhaps[merged_h0] < 0);
 					bool new_h1 = ((Mhaps[merged_h1] < 0) && (merged_h0 != merged_h1));
-					//if ((n_haps + new_h0 + new_h1) <= HAP_NUMBER) {
-						if (new_h0) Mhaps[merged_h0] = n_haps++;
-						if (new_h1) Mhaps[merged_h1] = n_haps++;
-					//}
+					if (new_h0) Mhaps[merged_h0] = n_haps++;
+					if (new_h1) Mhaps[merged_h1] = n_haps++;
 					if (n_haps == HAP_NUMBER && cumSumProbs > thresholdProbMass) vecTransStatistics[s-1].merged = true;
 				}
 			}
 		}
 
-		//Step8: update cursors (2)
-		for (unsigned int vrel = 0 ; vrel < Lengths[s-1] ; vrel ++) if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) aoffset++;
+		//Step7: update cursors (2)
+		aoffset += countAmbiguous(voffset, voffset + Lengths[s-1], c);
 		voffset += Lengths[s-1];
 		std::copy(curr_dipcodes, curr_dipcodes+curr_dipcount, prev_dipcodes);
 		prev_dipcount = curr_dipcount;
 		toffset += n_curr_transitions;
 	}
-	//Step9: map acceptable merges
+	//Step8: map acceptable merges
 	sort(vecTransStatistics.begin(), vecTransStatistics.end());
-	flagMerges = vector < bool > (n_segments+1, false);
+	MB.flagMerges.assign(n_segments+1, false);
 	for (unsigned int s = 0 ; s < vecTransStatistics.size() ; s ++) {
-		bool no_adjacent_merges = !flagMerges[vecTransStatistics[s].idx-1] && !flagMerges[vecTransStatistics[s].idx+1];
+		bool no_adjacent_merges = !MB.flagMerges[vecTransStatistics[s].idx-1] && !MB.flagMerges[vecTransStatistics[s].idx+1];
 		bool can_be_merged = vecTransStatistics[s].merged;
-		flagMerges[vecTransStatistics[s].idx] = (no_adjacent_merges && can_be_merged);
+		MB.flagMerges[vecTransStatistics[s].idx] = (no_adjacent_merges && can_be_merged);
 	}
 }
 
-void genotype::performMerges(vector < double > & currProbs, vector < bool > & flagMerges) {
-	vector < Transition > vecTransitions = vector < Transition > (4096);
+void genotype::performMerges(vector < double > & currProbs, merge_buffer & MB) {
+	vector < Transition > & vecTransitions = MB.vecTransitions;
+	vector < bool > & flagMerges = MB.flagMerges;
 
-	//Step0: initialize duplicates
-	vector < unsigned char > Ambiguous2 = vector < unsigned char > (Ambiguous.size(), 0);
-	vector < unsigned long > Diplotypes2;
-	vector < unsigned short > Lengths2;
+	//Step0: segments are compacted in place; the write cursor never overtakes the read cursor
 	unsigned int n_segments2 = n_segments;
 	for (int s = 0 ; s < flagMerges.size() ; s++) n_segments2 -= flagMerges[s];
-	Diplotypes2.reserve(n_segments2);
-	Lengths2.reserve(n_segments2);
+	unsigned int woffset = 0;
+	unsigned char mergedAmbiguous [MAX_AMB];
 
 	//Step1: initialize cursors
 	unsigned int prev_dipcount = countDiplotypes(Diplotypes[0]);
@@ -150,24 +128,30 @@ void genotype::performMerges(vector < double > & currProbs, vector < bool > & fl
 	std::copy(curr_dipcodes, curr_dipcodes+curr_dipcount, prev_dipcodes);
 	unsigned int toffset = prev_dipcount;
 	unsigned int n_curr_transitions = 0;
-	unsigned int aoffset = 0, voffset = 0;
+	unsigned int aoffset = 0, voffset = 0, c = 0;
 
 	for (int s = 1 ; s < flagMerges.size() -1 ; s ++) {
 		//Step1: update cursors (1)
 		curr_dipcount = countDiplotypes(Diplotypes[s]);
 		n_curr_transitions = prev_dipcount * curr_dipcount;
 		makeDiplotypes(Diplotypes[s]);
+		unsigned int prev_length = Lengths[s-1];
 
 		//case1: merge to be done
 		if (flagMerges[s]) {
-			//cout << name << " M " << aoffset << endl;
-			Lengths2.push_back(Lengths[s-1]+Lengths[s]);
-			Diplotypes2.push_back(0x0000000000000000UL);
+			unsigned int merged_length = Lengths[s-1]+Lengths[s];
+			unsigned long merged_diplotypes = 0x0000000000000000UL;
+			unsigned int n_ambiguous_prev = countAmbiguous(voffset, voffset + prev_length, c);
+			unsigned int n_ambiguous_merged = n_ambiguous_prev + countAmbiguous(voffset + prev_length, voffset + merged_length, c);
+			std::fill(mergedAmbiguous, mergedAmbiguous + n_ambiguous_merged, 0);
 			for (int t = 0 ; t < n_curr_transitions ; t ++) { vecTransitions[t].prob = currProbs[toffset + t]; vecTransitions[t].idx = t; }
-			sort(vecTransitions.begin(), vecTransitions.begin() + n_curr_transitions);
 			int n_haps = 0;
-			vector < int > Mhaps = vector < int >(HAP_NUMBER * HAP_NUMBER, -1);
+			int Mhaps [HAP_NUMBER * HAP_NUMBER];
+			std::fill(Mhaps, Mhaps + HAP_NUMBER * HAP_NUMBER, -1);
+			unsigned int n_sorted = 0;
 			for (int t = 0 ; t < n_curr_transitions ; t ++) {
+				//Order only matters until all haplotypes are mapped; remaining transitions are scanned unsorted
+				if (t == n_sorted && n_haps < HAP_NUMBER) extendSortedTransitions(vecTransitions, n_sorted, n_curr_transitions);
 				unsigned int prev_dip = prev_dipcodes[vecTransitions[t].idx/curr_dipcount];
 				unsigned int next_dip = curr_dipcodes[vecTransitions[t].idx%curr_dipcount];
 				unsigned int prev_h0 = DIP_HAP0(prev_dip);
@@ -181,63 +165,45 @@ void genotype::performMerges(vector < double > & currProbs, vector < bool > & fl
 				if ((n_haps + new_h0 + new_h1) <= HAP_NUMBER) {
 					if (new_h0) {
 						Mhaps[merged_h0] = n_haps;
-						for (unsigned int vrel = 0, arel = 0 ; vrel < (Lengths[s-1]+Lengths[s]) ; vrel ++) {
-							if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) {
-								if (HAP_GET(Ambiguous[aoffset+arel], (vrel<Lengths[s-1])?prev_h0:next_h0)) HAP_SET(Ambiguous2[aoffset+arel], Mhaps[merged_h0]);
-								arel ++;
-							}
-						}
+						for (unsigned int arel = 0 ; arel < n_ambiguous_merged ; arel ++)
+							if (HAP_GET(Ambiguous[aoffset+arel], (arel<n_ambiguous_prev)?prev_h0:next_h0)) HAP_SET(mergedAmbiguous[arel], Mhaps[merged_h0]);
 						n_haps ++;
 					}
 					if (new_h1) {
 						Mhaps[merged_h1] = n_haps;
-						for (unsigned int vrel = 0, arel = 0 ; vrel < (Lengths[s-1]+Lengths[s]) ; vrel ++) {
-							if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) {
-								if (HAP_GET(Ambiguous[aoffset+arel], (vrel<Lengths[s-1])?prev_h1:next_h1)) HAP_SET(Ambiguous2[aoffset+arel], Mhaps[merged_h1]);
-								arel ++;
-							}
-						}
+						for (unsigned int arel = 0 ; arel < n_ambiguous_merged ; arel ++)
+							if (HAP_GET(Ambiguous[aoffset+arel], (arel<n_ambiguous_prev)?prev_h1:next_h1)) HAP_SET(mergedAmbiguous[arel], Mhaps[merged_h1]);
 						n_haps ++;
 					}
-					DIP_SET(Diplotypes2.back(), Mhaps[merged_h0] * HAP_NUMBER + Mhaps[merged_h1]);
+					DIP_SET(merged_diplotypes, Mhaps[merged_h0] * HAP_NUMBER + Mhaps[merged_h1]);
 				}
 			}
 			assert(n_haps == HAP_NUMBER);
-		//Case2: no merge to be done, push last segment
+			std::copy(mergedAmbiguous, mergedAmbiguous + n_ambiguous_merged, Ambiguous + aoffset);
+			Lengths[woffset] = merged_length;
+			Diplotypes[woffset] = merged_diplotypes;
+			woffset ++;
+		//Case2: no merge to be done, keep last segment (ambiguous data stays in place)
 		} else if (!flagMerges[s-1]) {
-			//cout << name << " C " << aoffset << endl;
-			for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths[s-1] ; vrel ++) {
-				if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) {
-					Ambiguous2[aoffset+arel] = Ambiguous[aoffset+arel];
-					arel ++;
-				}
-			}
-			Lengths2.push_back(Lengths[s-1]);
-			Diplotypes2.push_back(Diplotypes[s-1]);
+			Lengths[woffset] = Lengths[s-1];
+			Diplotypes[woffset] = Diplotypes[s-1];
+			woffset ++;
 		}
 
 		//Update cursors
-		for (unsigned int vrel = 0 ; vrel < Lengths[s-1] ; vrel ++) if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) aoffset++;
-		voffset += Lengths[s-1];
+		aoffset += countAmbiguous(voffset, voffset + prev_length, c);
+		voffset += prev_length;
 		std::copy(curr_dipcodes, curr_dipcodes+curr_dipcount, prev_dipcodes);
 		prev_dipcount = curr_dipcount;
 		toffset += n_curr_transitions;
 	}
 	if (!flagMerges[flagMerges.size()-2]) {
-		for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths.back() ; vrel ++) {
-			if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) {
-				Ambiguous2[aoffset+arel] = Ambiguous[aoffset+arel];
-				arel ++;
-			}
-		}
-		Lengths2.push_back(Lengths.back());
-		Diplotypes2.push_back(Diplotypes.back());
+		Lengths[woffset] = Lengths[n_segments-1];
+		Diplotypes[woffset] = Diplotypes[n_segments-1];
+		woffset ++;
 	}
+	assert(woffset == n_segments2);
 
-	//free();
-	Ambiguous = Ambiguous2;
-	Diplotypes = Diplotypes2;
-	Lengths = Lengths2;
 	n_segments = n_segments2;
 	n_transitions = countTransitions();
 }
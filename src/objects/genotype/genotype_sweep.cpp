@@ -22,7 +22,7 @@
 #include <objects/genotype/genotype_header.h>
 
 // TO DO: make it forward-backward
-void genotype::sample(vector < double > & CurrentTransProbabilities) {
+unsigned int genotype::sample(vector < double > & CurrentTransProbabilities) {
 	double sumProbs = 0.0;
 	unsigned int prev_sampled = 0;
 	unsigned int curr_dipcount = 0, prev_dipcount = 1;
@@ -39,41 +39,47 @@ void genotype::sample(vector < double > & CurrentTransProbabilities) {
 		toffset += prev_dipcount * curr_dipcount;
 		prev_dipcount = curr_dipcount;
 	}
-	make(DipSampled);
+	return make(DipSampled);
 }
 
 void genotype::solve() {
-	unsigned int curr_dipcount = 0, prev_dipcount = 1;
-	vector < vector < double > > maxProbs = vector < vector < double > > (n_segments, vector < double > ());
-	vector < vector < int > > maxIndexes = vector < vector < int > > (n_segments, vector < int > ());
-
-	for (int s = 0, toffset = 0, trel = 0 ; s < n_segments ; s ++) {
+	//1. Forward pass: only the max probabilities of the previous segment are kept, back-pointers are stored flat
+	unsigned int curr_dipcount = 0, prev_dipcount = 1, n_dipcodes = 0;
+	for (unsigned int s = 0 ; s < n_segments ; s ++) n_dipcodes += countDiplotypes(Diplotypes[s]);
+	vector < unsigned char > maxIndexes = vector < unsigned char > (n_dipcodes, 0);
+	double prevMaxProbs [64], currMaxProbs [64];
+	unsigned long mask_word = 0UL;
+	for (unsigned int s = 0, toffset = 0, trel = 0, ioffset = 0 ; s < n_segments ; s ++) {
 		curr_dipcount = countDiplotypes(Diplotypes[s]);
-		maxProbs[s] = vector < double > (curr_dipcount, 0.0);
-		maxIndexes[s] = vector < int > (curr_dipcount, 0);
-		for (int t = 0 ; t < prev_dipcount * curr_dipcount ; t++) {
-			int prev_dip = t/curr_dipcount;
-			int next_dip = t%curr_dipcount;
-			//double currProb = (s?maxProbs[s-1][prev_dip]:1.0) * StoredProbs[t+toffset];
-			double currProb = (s?maxProbs[s-1][prev_dip]:1.0) * (ProbMask[t+toffset]?ProbStored[trel++]:5e-7);
-			if (currProb > maxProbs[s][next_dip]) {
-				maxProbs[s][next_dip] = currProb;
-				maxIndexes[s][next_dip] = prev_dip;
+		std::fill(currMaxProbs, currMaxProbs + curr_dipcount, 0.0);
+		for (unsigned int t = 0, tabs = toffset ; t < prev_dipcount * curr_dipcount ; t++, tabs++) {
+			if (!(tabs & 63)) mask_word = ((tabs >> 6) < ProbMask.size())?ProbMask[tabs >> 6]:0UL;
+			unsigned int prev_dip = t/curr_dipcount;
+			unsigned int next_dip = t%curr_dipcount;
+			double currProb = (s?prevMaxProbs[prev_dip]:1.0) * (((mask_word >> (tabs & 63)) & 1UL)?ProbStored[trel++]:5e-7);
+			if (currProb > currMaxProbs[next_dip]) {
+				currMaxProbs[next_dip] = currProb;
+				maxIndexes[ioffset + next_dip] = prev_dip;
 			}
 		}
 		double sumProb = 0.0;
-		for (int d = 0 ; d < curr_dipcount ; d ++) sumProb += maxProbs[s][d];
-		for (int d = 0 ; d < curr_dipcount ; d ++) maxProbs[s][d] /= sumProb;
+		for (unsigned int d = 0 ; d < curr_dipcount ; d ++) sumProb += currMaxProbs[d];
+		for (unsigned int d = 0 ; d < curr_dipcount ; d ++) prevMaxProbs[d] = currMaxProbs[d] / sumProb;
 		toffset += prev_dipcount * curr_dipcount;
+		ioffset += curr_dipcount;
 		prev_dipcount = curr_dipcount;
 	}
 
+	//2. Backtracking
 	vector < unsigned char > DipSampled = vector < unsigned char >(n_segments, 0);
-	unsigned int bestDip = alg.imax(maxProbs.back());
-	makeDiplotypes(Diplotypes.back());
+	unsigned int bestDip = 0;
+	for (unsigned int d = 1 ; d < curr_dipcount ; d ++) if (prevMaxProbs[d] > prevMaxProbs[bestDip]) bestDip = d;
+	makeDiplotypes(Diplotypes[n_segments-1]);
 	DipSampled.back() = curr_dipcodes[bestDip];
-	for (int s = DipSampled.size() - 2 ; s >= 0 ; s --) {
-		bestDip = maxIndexes[s+1][bestDip];
+	for (int s = DipSampled.size() - 2, ioffset = n_dipcodes - curr_dipcount ; s >= 0 ; s --) {
+		bestDip = maxIndexes[ioffset + bestDip];
+		curr_dipcount = countDiplotypes(Diplotypes[s]);
+		ioffset -= curr_dipcount;
 		makeDiplotypes(Diplotypes[s]);
 		DipSampled[s] = curr_dipcodes[bestDip];
 	}
@@ -81,24 +87,16 @@ void genotype::solve() {
 }
 
 void genotype::store(vector < double > & CurrentTransProbabilities) {
-        if (ProbMask.size() == 0) {
+	if (ProbMask.size() == 0) {
 		unsigned int countProb = 0;
-		ProbMask = vector < bool > (n_transitions, false);
+		ProbMask = vector < unsigned long > ((n_transitions + 63) / 64, 0UL);
 		for (unsigned int t = 0 ; t < n_transitions ; t ++) if (CurrentTransProbabilities[t] >= 1e-6) {
-			ProbMask[t] = true;
+			ProbMask[t >> 6] |= (1UL << (t & 63));
 			countProb++;
 		}
-		ProbStored = vector  < float > (countProb, 0.0);
-	}
-	for (unsigned int t = 0, trel = 0 ; t < n_transitions ; t ++) if (ProbMask[t]) ProbStored[trel++] += CurrentTransProbabilities[t];
-}
-
-/*
-void genotype::store(vector < double > & CurrentTransProbabilities) {
-	if (StoredProbs.size() == 0) StoredProbs = vector < float > (n_transitions, 0.0);
-	for (unsigned int t = 0 ; t < n_transitions ; t ++) {
-		StoredProbs[t] += CurrentTransProbabilities[t];
-		//cout << t << " " << StoredProbs[t] << " " << CurrentTransProbabilities[t] << endl;
+		ProbStored = vector < float > (countProb, 0.0);
 	}
+	for (unsigned int w = 0, trel = 0 ; w < ProbMask.size() ; w ++)
+		for (unsigned long mask_word = ProbMask[w] ; mask_word ; mask_word &= mask_word - 1)
+			ProbStored[trel++] += CurrentTransProbabilities[(w << 6) + __builtin_ctzl(mask_word)];
 }
-*/
@@ -39,8 +39,8 @@ void hmm_parameters::initialise(variant_map & mapG, int Neff, int Nhap, int Nsta
 	tfreq = vector < double > (mapG.size() - 1, 0.0);
 	for (int l = 1 ; l < mapG.size() ; l ++) {
 		double rho;
-		if (gmap) rho = 0.04 * Neff * (mapG.vec_pos[l]->cm - mapG.vec_pos[l-1]->cm);
-		else 0.0004 *  (mapG.vec_pos[l]->bp - mapG.vec_pos[l-1]->bp);
+		if (gmap) rho = 0.04 * Neff * (mapG.vec_cm[l] - mapG.vec_cm[l-1]);
+		else 0.0004 *  (mapG.vec_bp[l] - mapG.vec_bp[l-1]);
 		if (rho == 0.0) rho = 0.00001;
 		nt[l-1] = exp(-1.0 * rho / Nhap);
 		t[l-1] = 1-nt[l-1];
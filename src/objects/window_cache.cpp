@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <objects/window_cache.h>
+
+void window_cache::clear() {
+	vector < unsigned int > ().swap(boundaries);
+	vector < unsigned long > ().swap(keys);
+	vector < double > ().swap(probs);
+}
+
+unsigned long window_cache::key(vector < unsigned int > & K) {
+	//FNV-1a over the sorted haplotype indexes; 0 is kept for windows not cached
+	unsigned long h = 14695981039346656037UL;
+	for (unsigned int k = 0 ; k < K.size() ; k ++) {
+		h ^= K[k];
+		h *= 1099511628211UL;
+	}
+	return h?h:1UL;
+}
+
+bool window_cache::restore(unsigned int w, unsigned long k, coordinates & C, vector < double > & T) {
+	if (w >= keys.size() || keys[w] != k) return false;
+	//The first window also carries the initial probabilities of the first segment
+	int first = C.start_segment?C.start_transition:0;
+	for (int t = first ; t <= C.stop_transition ; t ++) T[t] = probs[t];
+	return true;
+}
+
+void window_cache::store(unsigned int w, unsigned long k, coordinates & C, vector < double > & T, unsigned int n_transitions) {
+	if (probs.size() != n_transitions) probs = vector < double > (n_transitions, 0.0);
+	if (keys.size() <= w) keys.resize(w + 1, 0UL);
+	int first = C.start_segment?C.start_transition:0;
+	for (int t = first ; t <= C.stop_transition ; t ++) probs[t] = T[t];
+	keys[w] = k;
+}
+
+unsigned long window_cache::sizeOf() {
+	return boundaries.capacity() * sizeof(unsigned int) + keys.capacity() * sizeof(unsigned long) + probs.capacity() * sizeof(double);
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _WINDOW_CACHE_H
+#define _WINDOW_CACHE_H
+
+#include <utils/otools.h>
+
+#include <objects/compute_job.h>
+
+/*
+ * Transition probabilities of the windows of one individual as last computed by the HMM (--window-cache).
+ * The window split is kept as long as the genotype graph is unchanged, so that a window can be reused when
+ * its conditioning haplotypes are the same (same key) and none of them changed allele over its variants.
+ */
+class window_cache {
+public:
+	vector < unsigned int > boundaries;		//Window split of the individual, as output by split (empty when not set)
+	vector < unsigned long > keys;			//Hash of the conditioning haplotypes of each window (0 when not cached)
+	vector < double > probs;				//Transition probabilities of the individual, filled window by window
+
+	window_cache() {}
+	~window_cache() {}
+
+	void clear();
+	static unsigned long key(vector < unsigned int > &);
+	bool restore(unsigned int, unsigned long, coordinates &, vector < double > &);
+	void store(unsigned int, unsigned long, coordinates &, vector < double > &, unsigned int);
+	unsigned long sizeOf();
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include <phaser/phaser_header.h>
 
 #include <io/haplotype_writer.h>
+#include <io/mcmc_checkpoint.h>
 
 void * phaseWindow_callback(void * ptr) {
 	phaser * S = static_cast< phaser * >( ptr );
@@ -39,36 +40,109 @@ void * phaseWindow_callback(void * ptr) {
 	}
 }
 
+bool phaser::isConverged(int id_worker, int id_job) {
+	//Conditioning haplotypes of all windows and the HMM work they imply
+	compute_job & J = threadData[id_worker];
+	vector < unsigned int > K;
+	double work = 0.0;
+	for (int w = 0 ; w < J.size() ; w ++) {
+		work += J.Kvec[w].size() * (J.C[w].stop_locus - J.C[w].start_locus + 1.0);
+		K.insert(K.end(), J.Kvec[w].begin(), J.Kvec[w].end());
+	}
+	sort(K.begin(), K.end());
+	K.erase(unique(K.begin(), K.end()), K.end());
+
+	//Fraction of conditioning haplotypes that changed since the HMM of the individual was last computed
+	vector < unsigned int > & P = freezeK[id_job];
+	unsigned int n_common = 0;
+	for (int i = 0, j = 0 ; i < K.size() && j < P.size() ; ) {
+		if (K[i] < P[j]) i ++;
+		else if (K[i] > P[j]) j ++;
+		else { n_common ++; i ++; j ++; }
+	}
+	double changeK = 1.0 - n_common * 1.0 / max(1UL, K.size() + P.size() - n_common);
+
+	//Frozen when both its haplotypes and its conditioning set are stable; main iterations need at least one stored sample
+	bool frozen = (freezeSwitches[id_job] <= options["mcmc-freeze"].as < double > () && changeK <= options["mcmc-freeze-K"].as < double > ());
+	if (iteration_types[iteration_stage] == STAGE_MAIN && G.vecG[id_job]->ProbMask.size() == 0) frozen = false;
+	if (!frozen) P.swap(K);
+
+	if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
+	work_total += work;
+	if (frozen) { work_frozen += work; n_frozen ++; }
+	if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
+	return frozen;
+}
+
+void phaser::adaptDepth(int id_worker, int id_job, int w, int n_underflows) {
+	//One neighbour more where the posteriors are uncertain or the conditioning haplotypes poorly match, one less where they are sharp
+	compute_job & J = threadData[id_worker];
+	double entropy = J.entropy(id_job, w);
+	int depth = J.Dvec[w];
+	if (n_underflows > 0 || entropy > DEPTH_ENTROPY_HIGH) depth = min(depth + 1, options["pbwt-depth-max"].as < int > ());
+	else if (entropy < DEPTH_ENTROPY_LOW) depth = max(depth - 1, options["pbwt-depth-min"].as < int > ());
+	unsigned char * blocks = &depthBlocks[id_job * n_depth_blocks];
+	for (int b = J.C[w].start_locus / DEPTH_BLOCK ; b <= J.C[w].stop_locus / DEPTH_BLOCK ; b ++) blocks[b] = depth;
+}
+
 void phaser::phaseWindow(int id_worker, int id_job) {
-	threadData[id_worker].make(id_job, options["window"].as < double > ());
+	window_cache * WC = options.count("window-cache")?(&cacheW[id_job]):NULL;
+	const unsigned char * depths = options.count("pbwt-depth-adaptive")?(&depthBlocks[id_job * n_depth_blocks]):NULL;
+	threadData[id_worker].make(id_job, options["window"].as < double > (), WC?(&WC->boundaries):NULL, depths);
+	if (options.count("mcmc-freeze") && iteration_types[iteration_stage] != STAGE_PRUN && isConverged(id_worker, id_job)) {
+		//Allele changes are only tracked from one iteration to the next, so the windows of skipped individuals cannot be reused later
+		if (WC) WC->clear();
+		return;
+	}
+	unsigned int n_cached = 0;
 	for (int w = 0 ; w < threadData[id_worker].size() ; w ++) {
 		if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
 		statH.push(threadData[id_worker].Kvec[w].size()*1.0);
-		statS.push((V.vec_pos[threadData[id_worker].C[w].stop_locus]->bp - V.vec_pos[threadData[id_worker].C[w].start_locus]->bp + 1) * 1.0 / 1e6);
+		statS.push((V.vec_bp[threadData[id_worker].C[w].stop_locus] - V.vec_bp[threadData[id_worker].C[w].start_locus] + 1) * 1.0 / 1e6);
 		if (options.count("mcmc-store-K")) storedKsizes.push_back(threadData[id_worker].Kvec[w].size()*1.0);
+		if (depths) {
+			depthWindows[threadData[id_worker].Dvec[w]] ++;
+			work_hmm += threadData[id_worker].Kvec[w].size() * (threadData[id_worker].C[w].stop_locus - threadData[id_worker].C[w].start_locus + 1.0);
+		}
 		if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
 		assert(threadData[id_worker].Kvec[w].size()>0);
 
+		//Same conditioning haplotypes without allele change over the window: same HMM result as last time
+		unsigned long key = WC?window_cache::key(threadData[id_worker].Kvec[w]):0UL;
+		if (WC && WC->restore(w, key, threadData[id_worker].C[w], threadData[id_worker].T)) {
+			if (!H.dirty(threadData[id_worker].Kvec[w], threadData[id_worker].C[w].start_locus, threadData[id_worker].C[w].stop_locus)) { n_cached ++; continue; }
+		}
+
 		haplotype_segment HS(G.vecG[id_job], H.H_opt_hap, threadData[id_worker].Kvec[w], threadData[id_worker].C[w], M);
 		int outcome = HS.expectation(threadData[id_worker].T);
 		if (outcome < 0) vrb.error("Underflow impossible to recover");
 		else n_underflow_recovered += outcome;
+		if (depths) adaptDepth(id_worker, id_job, w, outcome);
+		if (WC) WC->store(w, key, threadData[id_worker].C[w], threadData[id_worker].T, G.vecG[id_job]->n_transitions);
+	}
+	if (WC) {
+		if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
+		n_windows += threadData[id_worker].size();
+		n_windows_cached += n_cached;
+		if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
 	}
 
 	if (options.count("use-PS") && G.vecG[id_job]->ProbabilityMask.size() > 0) threadData[id_worker].maskingTransitions(id_job, options["use-PS"].as < double > ());
 
-	vector < bool > flagMerges;
+	unsigned int n_switches = 0;
 	switch (iteration_types[iteration_stage]) {
-	case STAGE_BURN:	G.vecG[id_job]->sample(threadData[id_worker].T);
+	case STAGE_BURN:	n_switches = G.vecG[id_job]->sample(threadData[id_worker].T);
 						break;
-	case STAGE_PRUN:	G.vecG[id_job]->sample(threadData[id_worker].T);
-						G.vecG[id_job]->mapMerges(threadData[id_worker].T, options["mcmc-prune"].as < double > (), flagMerges);
-						G.vecG[id_job]->performMerges(threadData[id_worker].T, flagMerges);
+	case STAGE_PRUN:	n_switches = G.vecG[id_job]->sample(threadData[id_worker].T);
+						G.vecG[id_job]->mapMerges(threadData[id_worker].T, options["mcmc-prune"].as < double > (), threadData[id_worker].MB);
+						G.vecG[id_job]->performMerges(threadData[id_worker].T, threadData[id_worker].MB);
+						if (WC) WC->clear();
 						break;
-	case STAGE_MAIN:	G.vecG[id_job]->sample(threadData[id_worker].T);
+	case STAGE_MAIN:	n_switches = G.vecG[id_job]->sample(threadData[id_worker].T);
 						G.vecG[id_job]->store(threadData[id_worker].T);
 						break;
 	}
+	if (options.count("mcmc-freeze")) freezeSwitches[id_job] = n_switches * 1.0f / max(1U, G.vecG[id_job]->n_ambiguous);
 }
 
 void phaser::phaseWindow() {
@@ -78,6 +152,12 @@ void phaser::phaseWindow() {
 	i_workers = 0; i_jobs = 0;
 	statH.clear(); statS.clear();
 	storedKsizes.clear();
+	n_frozen = 0; work_total = work_frozen = 0.0;
+	n_windows = n_windows_cached = 0;
+	if (options.count("pbwt-depth-adaptive")) {
+		depthWindows = vector < unsigned long > (H.depth + 1, 0);
+		work_hmm = 0.0;
+	}
 	if (n_thread > 1) {
 		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, phaseWindow_callback, static_cast<void *>(this));
 		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
@@ -87,12 +167,46 @@ void phaser::phaseWindow() {
 	}
 	if (n_underflow_recovered) vrb.bullet("HMM computations [K=" + stb.str(statH.mean(), 1) + "+/-" + stb.str(statH.sd(), 1) + " / W=" + stb.str(statS.mean(), 2) + "Mb / U=" + stb.str(n_underflow_recovered) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 	else vrb.bullet("HMM computations [K=" + stb.str(statH.mean(), 1) + "+/-" + stb.str(statH.sd(), 1) + " / W=" + stb.str(statS.mean(), 2) + "Mb] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	if (options.count("pbwt-depth-adaptive")) {
+		unsigned long n_windows_depth = 0;
+		for (int d = 0 ; d <= H.depth ; d ++) n_windows_depth += depthWindows[d];
+		string str_depth = "";
+		for (int d = 0 ; d <= H.depth ; d ++) if (depthWindows[d]) str_depth += (str_depth.size()?" / d":"d") + stb.str(d) + "=" + stb.str(depthWindows[d] * 100.0 / n_windows_depth, 1) + "%";
+		vrb.bullet("PBWT depth per window [" + str_depth + "] (work=" + stb.str(work_hmm / 1e6, 1) + "M)");
+	}
+	if (options.count("window-cache")) {
+		unsigned long size = 0;
+		for (int i = 0 ; i < G.n_ind ; i ++) size += cacheW[i].sizeOf();
+		vrb.bullet("Window cache [reused=" + stb.str(n_windows?(n_windows_cached * 100.0 / n_windows):0.0, 1) + "% of windows / mem=" + stb.str(size * 1.0 / (1024 * 1024), 2) + "MB]");
+	}
+	if (options.count("mcmc-freeze") && iteration_types[iteration_stage] != STAGE_PRUN) vrb.bullet("Convergence [frozen=" + stb.str(n_frozen * 100.0 / G.n_ind, 1) + "% of individuals / skipped=" + stb.str(work_total?(work_frozen * 100.0 / work_total):0.0, 1) + "% of HMM work]");
 }
 
 void phaser::phase() {
-	unsigned long n_old_segments = G.numberOfSegments(), n_new_segments = 0, current_iteration = 0;
-	for (iteration_stage = 0 ; iteration_stage < iteration_counts.size() ; iteration_stage ++) {
-		for (int iter = 0 ; iter < iteration_counts[iteration_stage] ; iter ++) {
+	unsigned long n_old_segments = 0, n_new_segments = 0, current_iteration = 0;
+	unsigned int first_stage = 0, first_iter = 0;
+	if (options.count("window-cache")) cacheW = vector < window_cache > (G.n_ind);
+	if (options.count("pbwt-depth-adaptive")) {
+		int depth = min(max(options["pbwt-depth"].as < int > (), options["pbwt-depth-min"].as < int > ()), options["pbwt-depth-max"].as < int > ());
+		n_depth_blocks = (V.size() + DEPTH_BLOCK - 1) / DEPTH_BLOCK;
+		depthBlocks = vector < unsigned char > (G.n_ind * n_depth_blocks, depth);
+	}
+	if (options.count("mcmc-freeze")) {
+		freezeSwitches = vector < float > (G.n_ind, 1.0f);
+		freezeK = vector < vector < unsigned int > > (G.n_ind);
+	}
+	//Pruning compression is measured against the graphs as built, also when resuming after a pruning iteration
+	n_old_segments = G.numberOfSegments();
+	mcmc_checkpoint checkpointer (H, G, freezeSwitches, freezeK, depthBlocks, options.count("checkpoint-dir")?options["checkpoint-dir"].as < string > ():string("."), options["mcmc-iterations"].as < string > ());
+	if (options.count("resume")) {
+		vrb.title("Resuming:");
+		if (checkpointer.load(first_stage, first_iter, current_iteration)) {
+			H.transposeH2V(false);
+			if (options.count("use-PS")) G.masking(options["thread"].as < int > ());
+		} else vrb.bullet("No checkpoint in [" + options["checkpoint-dir"].as < string > () + "], starting from the first iteration");
+	}
+	for (iteration_stage = first_stage ; iteration_stage < iteration_counts.size() ; iteration_stage ++) {
+		for (int iter = (iteration_stage == first_stage)?first_iter:0 ; iter < iteration_counts[iteration_stage] ; iter ++) {
 			switch (iteration_types[iteration_stage]) {
 			case STAGE_BURN:	vrb.title("Burn-in iteration [" + stb.str(iter+1) + "/" + stb.str(iteration_counts[iteration_stage]) + "]"); break;
 			case STAGE_PRUN:	vrb.title("Pruning iteration [" + stb.str(iter+1) + "/" + stb.str(iteration_counts[iteration_stage]) + "]"); break;
@@ -116,8 +230,10 @@ void phaser::phase() {
 				n_new_segments = G.numberOfSegments();
 				//vrb.bullet("Pruning info [old=" + stb.str(n_old_segments) + " / new=" + stb.str(n_new_segments) + " / compression=" + stb.str((1-n_new_segments*1.0/n_old_segments)*100, 2) + "%]");
 				vrb.bullet("Pruning outcome [compression=" + stb.str((1-n_new_segments*1.0/n_old_segments)*100, 2) + "%]");
-				if (options.count("use-PS")) G.masking();
+				if (options.count("use-PS")) G.masking(options["thread"].as < int > ());
 			}
+			if (options.count("checkpoint-dir")) checkpointer.save(iteration_stage, iter + 1, current_iteration);
 		}
 	}
+	checkpointer.wait();
 }
@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+#include <io/genotype_reader.h>
+#include <io/gmap_reader.h>
+#include <io/haplotype_ligater.h>
+
+bool phaser::parse_chunk_size(string str, double & value) {
+	//Sizes ending with cM are genetic distances, other sizes are numbers of variants
+	bool cm = (str.size() > 2 && (str.substr(str.size()-2) == "cM" || str.substr(str.size()-2) == "cm"));
+	value = std::stod(cm?str.substr(0, str.size()-2):str);
+	return cm;
+}
+
+void phaser::layout_chunks(vector < string > & regions) {
+	//step0: Positions of the variants in the region, in bp and cM
+	vector < int > positions;
+	genotype_reader readerG(H, G, V, options["region"].as < string > (), false, hts_pool.pool?(&hts_pool):NULL);
+	readerG.scanPositions(options["input"].as < string > (), positions);
+	gmap_reader readerGM;
+	readerGM.readGeneticMapFile(options["map"].as < string > ());
+	V.vec_bp.swap(positions);
+	V.vec_cm = vector < double > (V.vec_bp.size(), -1.0);
+	V.setGeneticMap(readerGM);
+
+	//step1: Coordinates of the variants in the units of the chunk size and of the overlap
+	double size, overlap;
+	bool size_cm = parse_chunk_size(options["chunk-size"].as < string > (), size);
+	bool overlap_cm = parse_chunk_size(options["chunk-overlap"].as < string > (), overlap);
+	int L = V.size();
+	vector < double > coord_size = vector < double > (L), coord_overlap = vector < double > (L);
+	for (int l = 0 ; l < L ; l ++) {
+		coord_size[l] = size_cm?V.vec_cm[l]:l;
+		coord_overlap[l] = overlap_cm?V.vec_cm[l]:l;
+	}
+
+	//step2: Cores of equal size tiling the region, each extended by half the overlap on both sides
+	int n_chunks = max(1, (int)round((coord_size.back() - coord_size[0]) / size));
+	vector < int > cores = vector < int > (1, 0);
+	for (int c = 1 ; c < n_chunks ; c ++) {
+		int l = std::lower_bound(coord_size.begin(), coord_size.end(), coord_size[0] + c * (coord_size.back() - coord_size[0]) / n_chunks) - coord_size.begin();
+		if (l > cores.back() && l < L) cores.push_back(l);
+	}
+	cores.push_back(L);
+	string chr = options["region"].as < string > ();
+	chr = chr.substr(0, chr.find_first_of(":"));
+	regions.clear();
+	for (unsigned int c = 0 ; c < cores.size() - 1 ; c ++) {
+		int from = (c == 0)?0:(std::lower_bound(coord_overlap.begin(), coord_overlap.end(), coord_overlap[cores[c]] - overlap / 2) - coord_overlap.begin());
+		int to = (c == cores.size() - 2)?(L - 1):(std::upper_bound(coord_overlap.begin(), coord_overlap.end(), coord_overlap[cores[c+1]] + overlap / 2) - coord_overlap.begin() - 1);
+		regions.push_back(chr + ":" + stb.str(V.vec_bp[from]) + "-" + stb.str(V.vec_bp[to]));
+		vrb.bullet("Chunk " + stb.str(c + 1) + " [" + regions.back() + " / L=" + stb.str(to - from + 1) + " / " + stb.str(V.vec_cm[to] - V.vec_cm[from], 2) + "cM]");
+	}
+	vector < int > ().swap(V.vec_bp);
+	vector < double > ().swap(V.vec_cm);
+}
+
+void phaser::phase_chunks() {
+	vrb.title("Chunking:");
+
+	//step0: htslib thread pool shared by all chunks
+	int n_thread = options["thread"].as < int > ();
+	if (n_thread > 1 && !(hts_pool.pool = hts_tpool_init(n_thread))) vrb.error("Impossible to create the htslib thread pool");
+
+	//step1: Split the region into overlapping chunks
+	vector < string > regions;
+	layout_chunks(regions);
+
+	//step2: Phase chunks one after the other, each one using all threads, and ligate them as they come
+	haplotype_ligater ligater(hts_pool.pool?(&hts_pool):NULL);
+	for (unsigned int c = 0 ; c < regions.size() ; c ++) {
+		vrb.title("Chunk [" + stb.str(c + 1) + "/" + stb.str(regions.size()) + "] : " + regions[c]);
+		phaser P;
+		P.options = options;
+		P.options.at("region").value() = boost::any(regions[c]);
+		P.iteration_types = iteration_types;
+		P.iteration_counts = iteration_counts;
+		P.hts_pool = hts_pool;
+		P.read_files_and_initialise();
+		P.phase();
+		P.solve_haplotypes();
+		vrb.title("Ligation:");
+		if (c == 0) ligater.open(options["output"].as < string > (), options.count("write-index"), P.G, P.V);
+		ligater.ligate(P.H, P.G, P.V);
+		if (n_thread > 1) pthread_mutex_destroy(&P.mutex_workers);
+	}
+
+	//step3: Write the last chunk
+	vrb.title("Finalization:");
+	ligater.close();
+	if (hts_pool.pool) hts_tpool_destroy(hts_pool.pool);
+	hts_pool.pool = NULL;
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+}
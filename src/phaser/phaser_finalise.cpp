@@ -23,6 +23,12 @@
 
 #include <io/haplotype_writer.h>
 
+void phaser::solve_haplotypes() {
+	G.solve(options["thread"].as < int > ());
+	H.update(G);
+	H.transposeH2V(false);
+}
+
 void phaser::write_files_and_finalise() {
 	vrb.title("Finalization:");
 
@@ -30,12 +36,14 @@ void phaser::write_files_and_finalise() {
 	if (options["thread"].as < int > () > 1) pthread_mutex_destroy(&mutex_workers);
 
 	//
-	G.solve();
-	H.update(G);
-	H.transposeH2V(false);
+	solve_haplotypes();
 
 	//step1: writing best guess haplotypes in VCF/BCF file
-	haplotype_writer(H, G, V).writeHaplotypes(options["output"].as < string > ());
+	haplotype_writer writerH (H, G, V, hts_pool.pool?(&hts_pool):NULL, options["thread"].as < int > ());
+	writerH.writeHaplotypes(options["output"].as < string > (), options.count("write-index"));
+	if (options.count("output-binary")) writerH.writeHaplotypesBinary(options["output-binary"].as < string > (), options.count("output-binary-deflate"));
+	if (hts_pool.pool) hts_tpool_destroy(hts_pool.pool);
+	hts_pool.pool = NULL;
 
 	//step2: Measure overall running time
 	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
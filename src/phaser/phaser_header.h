@@ -27,6 +27,7 @@
 #include <utils/otools.h>
 #include <objects/hmm_parameters.h>
 #include <models/haplotype_segment.h>
+#include <objects/window_cache.h>
 
 #include <containers/genotype_set.h>
 #include <containers/haplotype_set.h>
@@ -37,6 +38,9 @@
 #define STAGE_PRUN	1
 #define STAGE_MAIN	2
 
+#define DEPTH_ENTROPY_LOW	0.03	//Windows phased with a lower mean transition entropy lose one PBWT neighbour (--pbwt-depth-adaptive)
+#define DEPTH_ENTROPY_HIGH	0.08	//Windows phased with a higher one, or after an underflow, gain one
+
 class phaser {
 public:
 	//COMMAND LINE OPTIONS
@@ -54,6 +58,7 @@ public:
 	vector < pthread_t > id_workers;
 	pthread_mutex_t mutex_workers;
 	vector < compute_job > threadData;
+	htsThreadPool hts_pool;				//Shared htslib pool for BGZF (de)compression of all input and output files
 
 	//MCMC
 	vector < unsigned int > iteration_types;
@@ -65,6 +70,26 @@ public:
 	basic_stats statH,statS;
 	vector < double > storedKsizes;
 
+	//CONVERGENCE (--mcmc-freeze)
+	vector < float > freezeSwitches;					//Switch rate between the last two haplotype pairs sampled for each individual
+	vector < vector < unsigned int > > freezeK;			//Conditioning haplotypes of each individual when its HMM was last computed
+	unsigned long n_frozen;
+	double work_total, work_frozen;						//HMM work (conditioning haplotypes x variants) of the iteration, and of the frozen individuals
+
+	//ADAPTIVE DEPTH (--pbwt-depth-adaptive)
+	vector < unsigned char > depthBlocks;				//PBWT depth of each individual in each block of DEPTH_BLOCK variants
+	unsigned long n_depth_blocks;
+	vector < unsigned long > depthWindows;				//Number of windows phased at each depth in the iteration
+	double work_hmm;									//HMM work of the iteration (conditioning haplotypes x variants)
+
+	//WINDOW CACHE (--window-cache)
+	vector < window_cache > cacheW;						//HMM results of the windows of each individual
+	unsigned long n_windows, n_windows_cached;
+
+	//TWO-STAGE PHASING (--rare-mac)
+	unsigned int min_mac;								//Variants with a lower minor allele count in the target samples are left out of the run
+	phaser * common;									//Run having phased the common variants, whose haplotypes are a scaffold for this one
+
 	//CONSTRUCTOR
 	phaser();
 	~phaser();
@@ -73,6 +98,8 @@ public:
 	void phase();
 	void phaseWindow(int, int);
 	void phaseWindow();
+	bool isConverged(int, int);
+	void adaptDepth(int, int, int, int);
 
 	//PARAMETERS
 	void declare_options();
@@ -86,7 +113,16 @@ public:
 	//
 	void read_files_and_initialise();
 	void phase(vector < string > &);
+	void solve_haplotypes();
 	void write_files_and_finalise();
+
+	//CHUNKING
+	bool parse_chunk_size(string, double &);
+	void layout_chunks(vector < string > &);
+	void phase_chunks();
+
+	//TWO-STAGE PHASING
+	void phase_stages();
 };
 
 
@@ -24,6 +24,7 @@
 #include <io/genotype_reader.h>
 #include <io/haplotype_writer.h>
 #include <io/gmap_reader.h>
+#include <io/genotype_cache.h>
 
 #include <modules/builder.h>
 #include <modules/pbwt_solver.h>
@@ -37,39 +38,78 @@ void phaser::read_files_and_initialise() {
 		i_workers = 0; i_jobs = 0;
 		id_workers = vector < pthread_t > (options["thread"].as < int > ());
 		pthread_mutex_init(&mutex_workers, NULL);
+		//Chunks are given the pool of the run they belong to
+		if (!hts_pool.pool && !(hts_pool.pool = hts_tpool_init(options["thread"].as < int > ()))) vrb.error("Impossible to create the htslib thread pool");
 	}
 
-	//step2: Read input files
-	genotype_reader readerG(H, G, V, options["region"].as < string > (), options.count("use-PS"));
-	if (!options.count("reference")) readerG.scanGenotypes(options["input"].as < string > ());
-	else readerG.scanGenotypes(options["input"].as < string > (), options["reference"].as < string > ());
-	readerG.allocateGenotypes();
-	if (!options.count("reference") && !options.count("scaffold")) readerG.readGenotypes0(options["input"].as < string > ());
-	if ( options.count("reference") && !options.count("scaffold")) readerG.readGenotypes1(options["input"].as < string > (), options["reference"].as < string > ());
-	if (!options.count("reference") &&  options.count("scaffold")) readerG.readGenotypes2(options["input"].as < string > (), options["scaffold"].as < string > ());
-	if ( options.count("reference") &&  options.count("scaffold")) readerG.readGenotypes3(options["input"].as < string > (), options["reference"].as < string > (), options["scaffold"].as < string > ());
-	G.imputeMonomorphic(V);
+	//With an adaptive depth, the deepest neighbours are stored and each window uses a part of them
+	int depth = options.count("pbwt-depth-adaptive")?options["pbwt-depth-max"].as < int > ():options["pbwt-depth"].as < int > ();
 
-	//step3: Read and initialise genetic map
-	gmap_reader readerGM;
-	readerGM.readGeneticMapFile(options["map"].as < string > ());
-	V.setGeneticMap(readerGM);
-	M.initialise(V, options["effective-size"].as < int > (), (readerG.n_main_samples+readerG.n_ref_samples*2), 100UL, options.count("map"));
-
-	//step4: Initialize haplotypes
-	H.allocate(V, options["pbwt-modulo"].as < int > (), options["pbwt-depth"].as < int > ());
-	H.update(G, true);
-	H.transposeH2V(true);
-	H.searchIBD2((int)round((options["window"].as < double > () * V.size()) / V.length()));
-	if (!options.count("pbwt-disable-init")) {
-		pbwt_solver solver = pbwt_solver(H);
-		solver.sweep(G);
-		solver.free();
+	//step1: Reuse the data initialised by a previous run on the same input
+	genotype_cache cacheG(H, G, V);
+	unsigned long cache_key = 0;
+	bool cached = false;
+	if (options.count("cache")) {
+		vector < string > files = vector < string > (1, options["input"].as < string > ());
+		string settings = "I;R=" + options["region"].as < string > () + ";";
+		if (options.count("reference")) { files.push_back(options["reference"].as < string > ()); settings += "H;"; }
+		if (options.count("scaffold")) { files.push_back(options["scaffold"].as < string > ()); settings += "S;"; }
+		files.push_back(options["map"].as < string > ());
+		if (options.count("use-PS")) settings += "PS;";
+		if (options.count("sparse-genotypes")) settings += "SG;";
+		if (options.count("pbwt-disable-init")) settings += "NOPBWT;";
+		settings += "W=" + stb.str(options["window"].as < double > (), 12) + ";";
+		cache_key = genotype_cache::checksum(files, settings);
+		cached = cacheG.load(options["cache"].as < string > (), cache_key);
 	}
 
-	//step5: Initialize genotype structures
-	builder(G, options["thread"].as < int > ()).build();
-	if (options.count("use-PS")) G.masking();
+	if (cached) {
+		H.allocate(V, options["pbwt-modulo"].as < int > (), depth, options["thread"].as < int > ());
+		if (options.count("pbwt-fixed-reference") || options.count("pbwt-reference-cache")) H.buildReferencePBWT(V, options.count("pbwt-reference-cache")?options["pbwt-reference-cache"].as < string > ():"");
+	} else {
+		//step2: Read input files
+		genotype_reader readerG(H, G, V, options["region"].as < string > (), options.count("use-PS"), hts_pool.pool?(&hts_pool):NULL);
+		G.sparse = options.count("sparse-genotypes");
+		readerG.min_mac = min_mac;
+		bool panel = options.count("reference") && reference_panel::isPanel(options["reference"].as < string > ());
+		if (!options.count("reference") && !options.count("scaffold")) readerG.readGenotypes0(options["input"].as < string > ());
+		if ( options.count("reference") && !options.count("scaffold") && !panel) readerG.readGenotypes1(options["input"].as < string > (), options["reference"].as < string > ());
+		if ( options.count("reference") && !options.count("scaffold") &&  panel) readerG.readGenotypes4(options["input"].as < string > (), options["reference"].as < string > ());
+		if (!options.count("reference") &&  options.count("scaffold")) readerG.readGenotypes2(options["input"].as < string > (), options["scaffold"].as < string > ());
+		if ( options.count("reference") &&  options.count("scaffold") && !panel) readerG.readGenotypes3(options["input"].as < string > (), options["reference"].as < string > (), options["scaffold"].as < string > ());
+		if ( options.count("reference") &&  options.count("scaffold") &&  panel) readerG.readGenotypes5(options["input"].as < string > (), options["reference"].as < string > (), options["scaffold"].as < string > ());
+		G.compact();
+		vrb.bullet("Variant table [L=" + stb.str(V.size()) + " / mem=" + stb.str(V.sizeOf() * 1.0 / (1024 * 1024), 2) + "MB]");
+		G.imputeMonomorphic(V);
+		if (common) {
+			unsigned long n_scaffolded = G.scaffold(V, common->V, common->H.H_opt_var);
+			vrb.bullet("Scaffold of common variants [L=" + stb.str(common->V.size()) + " / Het=" + stb.str(n_scaffolded) + " fixed]");
+		}
+
+		//step3: Read genetic map
+		gmap_reader readerGM;
+		readerGM.readGeneticMapFile(options["map"].as < string > ());
+		V.setGeneticMap(readerGM);
+
+		//step4: Initialize haplotypes
+		H.allocate(V, options["pbwt-modulo"].as < int > (), depth, options["thread"].as < int > ());
+		H.transposeReferenceV2H();
+		H.update(G, true);
+		H.transposeH2V(false);
+		if (options.count("pbwt-fixed-reference") || options.count("pbwt-reference-cache")) H.buildReferencePBWT(V, options.count("pbwt-reference-cache")?options["pbwt-reference-cache"].as < string > ():"");
+		H.searchIBD2((int)round((options["window"].as < double > () * V.size()) / V.length()));
+		if (!options.count("pbwt-disable-init")) {
+			pbwt_solver solver = pbwt_solver(H);
+			solver.sweep(G);
+			solver.free();
+		}
+
+		//step5: Initialize genotype structures
+		builder(G, options["thread"].as < int > ()).build();
+		if (options.count("cache")) cacheG.save(options["cache"].as < string > (), cache_key);
+	}
+	if (options.count("use-PS")) G.masking(options["thread"].as < int > ());
+	M.initialise(V, options["effective-size"].as < int > (), H.n_hap - G.n_ind, 100UL, options.count("map"));
 
 	//step6: Allocate data structures for computations
 	unsigned int max_number_transitions = G.largestNumberOfTransitions();
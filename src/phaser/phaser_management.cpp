@@ -22,6 +22,10 @@
 #include <phaser/phaser_header.h>
 
 phaser::phaser() {
+	hts_pool.pool = NULL;
+	hts_pool.qsize = 0;
+	min_mac = 0;
+	common = NULL;
 }
 
 phaser::~phaser() {
@@ -37,9 +41,13 @@ void phaser::phase(vector < string > & args) {
 	check_options();
 	verbose_files();
 	verbose_options();
-	read_files_and_initialise();
-	phase();
-	write_files_and_finalise();
+	if (options.count("chunk-size")) phase_chunks();
+	else if (options.count("rare-mac")) phase_stages();
+	else {
+		read_files_and_initialise();
+		phase();
+		write_files_and_finalise();
+	}
 }
 
 void phaser::parse_iteration_scheme(string str_iter) {
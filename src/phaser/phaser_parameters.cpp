@@ -32,32 +32,51 @@ void phaser::declare_options() {
 	bpo::options_description opt_input ("Input files");
 	opt_input.add_options()
 			("input,I", bpo::value< string >(), "Genotypes to be phased in VCF/BCF format")
-			("reference,H", bpo::value< string >(), "Reference panel of haplotypes in VCF/BCF format")
+			("reference,H", bpo::value< string >(), "Reference panel of haplotypes in VCF/BCF format, or in binary format (see shapeit4 convert-reference)")
 			("scaffold,S", bpo::value< string >(), "Scaffold of haplotypes in VCF/BCF format")
 			("map,M", bpo::value< string >(), "Genetic map")
 			("region,R", bpo::value< string >(), "Target region")
-			("use-PS", bpo::value<double>(), "Informs phasing using PS field from read based phasing");
+			("chunk-size", bpo::value< string >(), "Phase the region by overlapping chunks of this size, in cM (e.g. 20cM) or in number of variants (e.g. 100000), ligated into the output")
+			("chunk-overlap", bpo::value< string >()->default_value("2cM"), "Overlap between consecutive chunks, in cM or in number of variants")
+			("use-PS", bpo::value<double>(), "Informs phasing using PS field from read based phasing")
+			("cache", bpo::value< string >(), "Cache of the initialised data, used in place of reading and initialising when input files, region, initialisation settings and --window match, written otherwise")
+			("sparse-genotypes", "Store genotypes as lists of non hom-ref variants (lower memory on sequencing data dominated by rare variants)");
 
 	bpo::options_description opt_mcmc ("MCMC parameters");
 	opt_mcmc.add_options()
 			("mcmc-iterations", bpo::value<string>()->default_value("5b,1p,1b,1p,1b,1p,5m"), "Iteration scheme of the MCMC")
 			("mcmc-prune", bpo::value<double>()->default_value(0.999), "Pruning threshold")
-			("mcmc-store-K", bpo::value<string>(), "Store K sizes in last iterations");
+			("mcmc-store-K", bpo::value<string>(), "Store K sizes in last iterations")
+			("mcmc-freeze", bpo::value<double>(), "Skip the HMM of individuals whose last sampled haplotypes switched at less than this fraction of their het variants, when their conditioning haplotypes also changed little (burn-in and main iterations)")
+			("mcmc-freeze-K", bpo::value<double>()->default_value(0.6, "0.6"), "Largest fraction of conditioning haplotypes changed since the last HMM of an individual for it to be skipped by --mcmc-freeze")
+			("rare-mac", bpo::value<int>(), "Phase the variants with a minor allele count below this value in the target samples in a second stage, onto the haplotypes of the other variants")
+			("rare-mcmc-iterations", bpo::value<string>(), "Iteration scheme of the MCMC of the second stage of --rare-mac (by default, rare heterozygotes are only placed by the PBWT phase sweep)")
+			("checkpoint-dir", bpo::value<string>(), "Directory where the MCMC state is saved after each iteration")
+			("resume", "Resume the MCMC from the state saved in --checkpoint-dir");
 
 	bpo::options_description opt_pbwt ("PBWT parameters");
 	opt_pbwt.add_options()
 			("pbwt-disable-init", "Do not initialise haplotypes by PBWT (rephase input haplotype data)")
 			("pbwt-modulo", bpo::value<int>()->default_value(8), "Storage frequency of PBWT indexes in variant numbers (i.e. 16 means storage every 16 variants)")
-			("pbwt-depth", bpo::value<int>()->default_value(4), "Depth of PBWT indexes to condition on");
+			("pbwt-depth", bpo::value<int>()->default_value(4), "Depth of PBWT indexes to condition on")
+			("pbwt-depth-adaptive", "Adapt the depth of each window between --pbwt-depth-min and --pbwt-depth-max from the uncertainty of its last phasing, starting from --pbwt-depth")
+			("pbwt-depth-min", bpo::value<int>()->default_value(2), "Smallest depth of PBWT indexes with --pbwt-depth-adaptive")
+			("pbwt-depth-max", bpo::value<int>()->default_value(8), "Largest depth of PBWT indexes with --pbwt-depth-adaptive")
+			("pbwt-fixed-reference", "Sort the reference haplotypes once and only insert target haplotypes at each iteration (uses 8 bytes per reference haplotype and variant)")
+			("pbwt-reference-cache", bpo::value< string >(), "File storing the PBWT of the reference haplotypes across runs, typically next to the converted panel (implies --pbwt-fixed-reference)");
 	
 	bpo::options_description opt_hmm ("HMM parameters");
 	opt_hmm.add_options()
 			("window,W", bpo::value<double>()->default_value(2e6), "Minimal size of the phasing window")
+			("window-cache", "Reuse the HMM results of windows whose conditioning haplotypes are unchanged since the last iteration (the window split of each individual is kept until it is pruned)")
 			("effective-size", bpo::value<int>()->default_value(15000), "Effective size of the population");
 
 	bpo::options_description opt_output ("Output files");
 	opt_output.add_options()
 			("output,O", bpo::value< string >(), "Phased haplotypes in VCF/BCF format")
+			("write-index", "Index the phased haplotypes while writing them (CSI for BCF, TBI for VCF.gz)")
+			("output-binary", bpo::value< string >(), "Phased haplotypes also written in bit-packed binary format")
+			("output-binary-deflate", "Compress the blocks of the binary output with deflate")
 			("log", bpo::value< string >(), "Log file");
 
 	descriptions.add(opt_base).add(opt_input).add(opt_mcmc).add(opt_pbwt).add(opt_hmm).add(opt_output);
@@ -109,6 +128,54 @@ void phaser::check_options() {
 	if (!options["window"].defaulted() && options["window"].as < double > () < 1e5)
 		vrb.error("You must specify a window size of at least 0.1 Mb");
 
+	if (options.count("write-index")) {
+		string fout = options["output"].as < string > ();
+		if (!(fout.size() > 6 && fout.substr(fout.size()-6) == "vcf.gz") && !(fout.size() > 3 && fout.substr(fout.size()-3) == "bcf"))
+			vrb.error("Indexing with --write-index requires a compressed output file (.vcf.gz or .bcf)");
+	}
+
+	if (options["pbwt-depth"].as < int > () < 1)
+		vrb.error("You must specify a positive depth of PBWT indexes with --pbwt-depth");
+
+	if (options.count("pbwt-depth-adaptive") && (options["pbwt-depth-min"].as < int > () < 1 || options["pbwt-depth-max"].as < int > () < options["pbwt-depth-min"].as < int > () || options["pbwt-depth-max"].as < int > () > 255))
+		vrb.error("You must specify 1 <= --pbwt-depth-min <= --pbwt-depth-max <= 255 to use --pbwt-depth-adaptive");
+
+	if (options.count("mcmc-freeze") && (options["mcmc-freeze"].as < double > () < 0 || options["mcmc-freeze"].as < double > () > 1))
+		vrb.error("You must specify a switch rate between 0 and 1 with --mcmc-freeze");
+
+	if (options["mcmc-freeze-K"].as < double > () < 0 || options["mcmc-freeze-K"].as < double > () > 1)
+		vrb.error("You must specify a fraction between 0 and 1 with --mcmc-freeze-K");
+
+	if (options.count("resume") && !options.count("checkpoint-dir"))
+		vrb.error("You must specify the directory of the checkpoint with --checkpoint-dir to use --resume");
+
+	if (options.count("resume") && options.count("window-cache"))
+		vrb.error("Resuming with --resume is not compatible with --window-cache, whose HMM results are not saved in checkpoints");
+
+	if ((options.count("pbwt-fixed-reference") || options.count("pbwt-reference-cache")) && !options.count("reference"))
+		vrb.error("You must specify a reference panel with --reference to use --pbwt-fixed-reference or --pbwt-reference-cache");
+
+	if (options.count("output-binary-deflate") && !options.count("output-binary"))
+		vrb.error("You must specify a binary output file with --output-binary to use --output-binary-deflate");
+
+	if (options.count("chunk-size")) {
+		double size, overlap;
+		bool size_cm = parse_chunk_size(options["chunk-size"].as < string > (), size);
+		bool overlap_cm = parse_chunk_size(options["chunk-overlap"].as < string > (), overlap);
+		if (size <= 0) vrb.error("You must specify a positive chunk size with --chunk-size");
+		if (overlap < 0 || (size_cm == overlap_cm && overlap >= size)) vrb.error("You must specify a chunk overlap smaller than the chunk size with --chunk-overlap");
+		if (options.count("cache") || options.count("checkpoint-dir") || options.count("mcmc-store-K") || options.count("pbwt-reference-cache") || options.count("output-binary"))
+			vrb.error("Phasing by chunks with --chunk-size is not compatible with --cache, --checkpoint-dir, --mcmc-store-K, --pbwt-reference-cache and --output-binary");
+	}
+
+	if (options.count("rare-mac")) {
+		if (options["rare-mac"].as < int > () < 1) vrb.error("You must specify a positive minor allele count with --rare-mac");
+		if (options.count("pbwt-disable-init") && !options.count("rare-mcmc-iterations")) vrb.error("Rare variants are placed by the PBWT phase sweep: use --rare-mcmc-iterations with --pbwt-disable-init");
+		if (options.count("chunk-size") || options.count("cache") || options.count("checkpoint-dir") || options.count("mcmc-store-K"))
+			vrb.error("Phasing in two stages with --rare-mac is not compatible with --chunk-size, --cache, --checkpoint-dir and --mcmc-store-K");
+		if (options.count("rare-mcmc-iterations")) parse_iteration_scheme(options["rare-mcmc-iterations"].as < string > ());
+	} else if (options.count("rare-mcmc-iterations")) vrb.error("You must specify a minor allele count with --rare-mac to use --rare-mcmc-iterations");
+
 	parse_iteration_scheme(options["mcmc-iterations"].as < string > ());
 }
 
@@ -118,7 +185,14 @@ void phaser::verbose_files() {
 	if (options.count("reference")) vrb.bullet("Reference VCF : [" + options["reference"].as < string > () + "]");
 	if (options.count("scaffold")) vrb.bullet("Scaffold VCF  : [" + options["scaffold"].as < string > () + "]");
 	vrb.bullet("Genetic Map   : [" + options["map"].as < string > () + "]");
+	if (options.count("cache")) vrb.bullet("Cache         : [" + options["cache"].as < string > () + "]");
 	vrb.bullet("Output VCF    : [" + options["output"].as < string > () + "]");
+	if (options.count("write-index")) {
+		string fout = options["output"].as < string > ();
+		vrb.bullet("Output index  : [" + fout + ((fout.substr(fout.size()-3) == "bcf")?".csi":".tbi") + "]");
+	}
+	if (options.count("output-binary")) vrb.bullet("Output BIN    : [" + options["output-binary"].as < string > () + "]");
+	if (options.count("checkpoint-dir")) vrb.bullet("Checkpoints   : [" + options["checkpoint-dir"].as < string > () + "/shapeit4.ckpt]" + (options.count("resume")?" / resume":""));
 	if (options.count("log")) vrb.bullet("Output LOG    : [" + options["log"].as < string > () + "]");
 }
 
@@ -127,9 +201,16 @@ void phaser::verbose_options() {
 	vrb.bullet("Seed    : " + stb.str(options["seed"].as < int > ()));
 	vrb.bullet("Threads : " + stb.str(options["thread"].as < int > ()) + " threads");
 	vrb.bullet("MCMC    : " + get_iteration_scheme());
+	if (options.count("mcmc-freeze")) vrb.bullet("MCMC    : Individuals frozen below " + stb.str(options["mcmc-freeze"].as < double > ()) + " switches per het / " + stb.str(options["mcmc-freeze-K"].as < double > ()) + " of conditioning haplotypes changed");
 	if (options.count("pbwt-disable-init")) vrb.bullet("PBWT    : No PBWT initialization");
 	vrb.bullet("PBWT    : Store indexes every " + stb.str(options["pbwt-modulo"].as < int > ()) + " variants");
-	vrb.bullet("PBWT    : Depth of PBWT neighbours to condition on: " + stb.str(options["pbwt-depth"].as < int > ()));
+	if (options.count("pbwt-depth-adaptive")) vrb.bullet("PBWT    : Depth of PBWT neighbours to condition on: adaptive in [" + stb.str(options["pbwt-depth-min"].as < int > ()) + "," + stb.str(options["pbwt-depth-max"].as < int > ()) + "] per window, starting from " + stb.str(options["pbwt-depth"].as < int > ()));
+	else vrb.bullet("PBWT    : Depth of PBWT neighbours to condition on: " + stb.str(options["pbwt-depth"].as < int > ()));
+	if (options.count("pbwt-fixed-reference") || options.count("pbwt-reference-cache")) vrb.bullet("PBWT    : Reference haplotypes sorted once" + (options.count("pbwt-reference-cache")?(" / cached in [" + options["pbwt-reference-cache"].as < string > () + "]"):string("")));
 	vrb.bullet("HMM     : K is variable / min W is " + stb.str(options["window"].as < double > ()/1e6, 2) + "Mb / Ne is "+ stb.str(options["effective-size"].as < int > ()));
+	if (options.count("window-cache")) vrb.bullet("HMM     : Windows with unchanged conditioning haplotypes reused across iterations");
 	if (options.count("use-PS")) vrb.bullet("HMM     : Inform phasing using VCF/PS field / Error rate of PS field is " + stb.str(options["use-PS"].as < double > ()));
+	if (options.count("sparse-genotypes")) vrb.bullet("Storage : Sparse genotypes");
+	if (options.count("rare-mac")) vrb.bullet("Stages  : Variants with MAC<" + stb.str(options["rare-mac"].as < int > ()) + " phased after the others, by PBWT phase sweep" + (options.count("rare-mcmc-iterations")?(" and MCMC [" + options["rare-mcmc-iterations"].as < string > () + "]"):string("")));
+	if (options.count("chunk-size")) vrb.bullet("Chunks  : " + options["chunk-size"].as < string > () + " / overlap of " + options["chunk-overlap"].as < string > () + " / ligated on heterozygous sites");
 }
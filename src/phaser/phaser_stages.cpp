@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+#include <io/haplotype_writer.h>
+
+void phaser::phase_stages() {
+	//step0: htslib thread pool shared by both stages
+	int n_thread = options["thread"].as < int > ();
+	if (n_thread > 1 && !(hts_pool.pool = hts_tpool_init(n_thread))) vrb.error("Impossible to create the htslib thread pool");
+	int mac = options["rare-mac"].as < int > ();
+
+	//step1: Phase the common variants through the full pipeline; this run is released once its haplotypes are used as scaffold
+	phaser P;
+	P.options = options;
+	P.hts_pool = hts_pool;
+	{
+		vrb.title("Common variants [MAC>=" + stb.str(mac) + "]");
+		phaser PC;
+		PC.options = options;
+		PC.iteration_types = iteration_types;
+		PC.iteration_counts = iteration_counts;
+		PC.hts_pool = hts_pool;
+		PC.min_mac = mac;
+		PC.read_files_and_initialise();
+		PC.phase();
+		PC.solve_haplotypes();
+		if (n_thread > 1) pthread_mutex_destroy(&PC.mutex_workers);
+
+		//step2: Read all variants, with the het genotypes of the common ones fixed to their phase, and place the rare hets by PBWT phase sweep
+		vrb.title("All variants [MAC<" + stb.str(mac) + " phased onto the common variants]");
+		P.common = &PC;
+		P.read_files_and_initialise();
+		P.common = NULL;
+	}
+
+	//step3: Optionally refine the rare hets by MCMC, with all common hets fixed
+	if (options.count("rare-mcmc-iterations")) {
+		P.parse_iteration_scheme(options["rare-mcmc-iterations"].as < string > ());
+		P.phase();
+		P.solve_haplotypes();
+	}
+	if (n_thread > 1) pthread_mutex_destroy(&P.mutex_workers);
+
+	//step4: Write the haplotypes of all variants
+	vrb.title("Finalization:");
+	haplotype_writer writerH (P.H, P.G, P.V, hts_pool.pool?(&hts_pool):NULL, n_thread);
+	writerH.writeHaplotypes(options["output"].as < string > (), options.count("write-index"));
+	if (options.count("output-binary")) writerH.writeHaplotypesBinary(options["output-binary"].as < string > (), options.count("output-binary-deflate"));
+	if (hts_pool.pool) hts_tpool_destroy(hts_pool.pool);
+	hts_pool.pool = NULL;
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+}